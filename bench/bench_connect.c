@@ -0,0 +1,171 @@
+/* Measures how long connecting takes and which step of it dominates. This
+ * listens on a free local display, the abstract socket where there is one
+ * and the socket file otherwise, serves each connection with the mock X
+ * server from the tests, and connects to it by display name in a tight
+ * loop, so every step xcb_connect takes is exercised. It prints the mean
+ * time of each step as reported by xcb_get_connect_timings, then the mean
+ * and tail of the whole xcb_connect and of connecting and disconnecting. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "xcb.h"
+#include "mock_server.h"
+
+#define CONNECTS 2000
+#define FIRST_DISPLAY 4711
+#define DISPLAYS_TRIED 100
+
+static char socket_file[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Binds the socket for one display, the way _xcb_open looks for it. */
+static int bind_display(int fd, int display)
+{
+    struct sockaddr_un addr;
+    socklen_t len;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+#ifdef HAVE_ABSTRACT_SOCKETS
+    len = snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "/tmp/.X11-unix/X%d", display);
+    len += offsetof(struct sockaddr_un, sun_path) + 1;
+#else
+    mkdir("/tmp/.X11-unix", 01777);
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "/tmp/.X11-unix/X%d", display);
+    if(!access(addr.sun_path, F_OK))
+        return 0;
+    len = sizeof(addr);
+#endif
+    if(bind(fd, (struct sockaddr *) &addr, len))
+        return 0;
+#ifndef HAVE_ABSTRACT_SOCKETS
+    strcpy(socket_file, addr.sun_path);
+#endif
+    return 1;
+}
+
+static void *accept_connections(void *arg)
+{
+    int listener = *(int *) arg, i;
+    for(i = 0; i < CONNECTS; ++i)
+    {
+        mock_server_t *server;
+        int fd = accept(listener, 0, 0);
+        if(fd < 0)
+            break;
+        server = mock_server_new();
+        if(!server)
+            break;
+        /* serves until the client disconnects */
+        mock_server_start(server, fd);
+        mock_server_free(server);
+    }
+    return 0;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void report(const char *name, const char *phase, uint64_t total_ns)
+{
+    printf("%s\tphase=%s\t%.1f ns/op\n", name, phase, (double) total_ns / CONNECTS);
+}
+
+static void report_tail(const char *name, double *samples)
+{
+    double total = 0;
+    int i;
+    for(i = 0; i < CONNECTS; ++i)
+        total += samples[i];
+    qsort(samples, CONNECTS, sizeof(*samples), compare_double);
+    printf("%s\t%.1f ns/op\tp50 %.0f ns\tp99 %.0f ns\tmax %.0f ns\n", name, total / CONNECTS,
+           samples[CONNECTS / 2], samples[CONNECTS * 99 / 100], samples[CONNECTS - 1]);
+}
+
+int main(int argc, char **argv)
+{
+    static double connect_ns[CONNECTS], cycle_ns[CONNECTS];
+    xcb_connect_timings_t sum = { 0 };
+    pthread_t acceptor;
+    char name[32];
+    int listener, display, i;
+
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listener < 0)
+        return EXIT_FAILURE;
+    for(display = FIRST_DISPLAY; display < FIRST_DISPLAY + DISPLAYS_TRIED; ++display)
+        if(bind_display(listener, display))
+            break;
+    if(display == FIRST_DISPLAY + DISPLAYS_TRIED || listen(listener, 16) ||
+       pthread_create(&acceptor, 0, accept_connections, &listener))
+    {
+        fprintf(stderr, "bench_connect: cannot listen on a local display\n");
+        return EXIT_FAILURE;
+    }
+    snprintf(name, sizeof(name), ":%d", display);
+
+    for(i = 0; i < CONNECTS; ++i)
+    {
+        xcb_connect_timings_t timings;
+        xcb_connection_t *c;
+        double start = now();
+
+        c = xcb_connect(name, 0);
+        connect_ns[i] = now() - start;
+        if(xcb_connection_has_error(c))
+        {
+            fprintf(stderr, "bench_connect: cannot connect to %s\n", name);
+            if(*socket_file)
+                unlink(socket_file);
+            return EXIT_FAILURE;
+        }
+        xcb_get_connect_timings(c, &timings);
+        sum.parse_display_ns += timings.parse_display_ns;
+        sum.open_ns += timings.open_ns;
+        sum.auth_ns += timings.auth_ns;
+        sum.write_setup_ns += timings.write_setup_ns;
+        sum.read_setup_ns += timings.read_setup_ns;
+        sum.ext_init_ns += timings.ext_init_ns;
+        sum.xid_init_ns += timings.xid_init_ns;
+        sum.total_ns += timings.total_ns;
+        xcb_disconnect(c);
+        cycle_ns[i] = now() - start;
+    }
+    pthread_join(acceptor, 0);
+    close(listener);
+    if(*socket_file)
+        unlink(socket_file);
+
+    report("connect", "parse_display", sum.parse_display_ns);
+    report("connect", "open", sum.open_ns);
+    report("connect", "auth", sum.auth_ns);
+    report("connect", "write_setup", sum.write_setup_ns);
+    report("connect", "read_setup", sum.read_setup_ns);
+    report("connect", "ext_init", sum.ext_init_ns);
+    report("connect", "xid_init", sum.xid_init_ns);
+    report("connect", "total", sum.total_ns);
+    report_tail("xcb_connect", connect_ns);
+    report_tail("connect_disconnect", cycle_ns);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,254 @@
+/* Measures how threads sharing one connection slow each other down. A run
+ * mixes three kinds of thread: senders send NoOp requests as fast as they
+ * can, round-trippers wait for one GetInputFocus reply after another, and
+ * consumers wait for, or poll for, events; the mock X server from the
+ * tests sends one MotionNotify for every EVENT_EVERY NoOps.
+ *
+ * Each argument names a mix as senders,round-trippers,consumers, with
+ * ",poll" appended to have the consumers poll. For every mix this prints a
+ * line per thread with its throughput and latency percentiles, then the
+ * time the run spent waiting for the connection's locks. */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "xcb.h"
+#include "mock_server.h"
+
+#define REQUESTS 200000
+#define EVENT_EVERY 16
+#define ROUND_TRIPS 2000
+#define MAX_THREADS 32
+
+typedef struct {
+    int senders;
+    int round_trippers;
+    int consumers;
+    int polling;
+} mix_t;
+
+typedef struct {
+    const char *kind;
+    int index;
+    pthread_t thread;
+    int ops;
+    uint32_t *latency;  /* ns per operation, sorted once the thread is done */
+    double elapsed;
+} worker_t;
+
+static xcb_connection_t *c;
+static int requests_per_sender;
+static int polling;
+
+static int send_motion(mock_server_t *server, const uint8_t *request, size_t length, uint16_t sequence, void *data)
+{
+    unsigned int *requests = data;
+    uint8_t event[32] = { XCB_MOTION_NOTIFY };
+    if(request[0] != XCB_NO_OPERATION)
+        return 0;
+    if(++*requests % EVENT_EVERY)
+        return 1;
+    *(uint16_t *) (event + 2) = sequence;
+    return mock_server_send(server, event, sizeof(event));
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void record(worker_t *w, double start)
+{
+    w->latency[w->ops++] = now() - start;
+}
+
+static void *send_requests(void *arg)
+{
+    worker_t *w = arg;
+    double start = now();
+    int i;
+    for(i = 0; i < requests_per_sender; ++i)
+    {
+        double t = now();
+        xcb_no_operation(c);
+        record(w, t);
+    }
+    xcb_flush(c);
+    w->elapsed = now() - start;
+    return 0;
+}
+
+static void *round_trip(void *arg)
+{
+    worker_t *w = arg;
+    double start = now();
+    int i;
+    for(i = 0; i < ROUND_TRIPS; ++i)
+    {
+        double t = now();
+        free(xcb_get_input_focus_reply(c, xcb_get_input_focus(c), 0));
+        record(w, t);
+    }
+    w->elapsed = now() - start;
+    return 0;
+}
+
+/* Consumers run until they see the KeyPress that main sends each of them
+ * once everyone else is done. */
+static void *consume_events(void *arg)
+{
+    worker_t *w = arg;
+    double start = now();
+    for(;;)
+    {
+        double t = now();
+        xcb_generic_event_t *event;
+        if(polling)
+            while(!(event = xcb_poll_for_event(c)) && !xcb_connection_has_error(c))
+                /* spin */;
+        else
+            event = xcb_wait_for_event(c);
+        if(!event)
+            break;
+        if(event->response_type == XCB_KEY_PRESS)
+        {
+            free(event);
+            break;
+        }
+        free(event);
+        if(w->ops < REQUESTS / EVENT_EVERY)
+            record(w, t);
+    }
+    w->elapsed = now() - start;
+    return 0;
+}
+
+static int compare_latency(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static uint32_t percentile(const worker_t *w, int p)
+{
+    return w->ops ? w->latency[(long) (w->ops - 1) * p / 1000] : 0;
+}
+
+static void report(const mix_t *mix, worker_t *w)
+{
+    qsort(w->latency, w->ops, sizeof(*w->latency), compare_latency);
+    printf("mix=%d,%d,%d%s\t%s%d\tops=%d\t%.0f ops/s\tp50 %u ns\tp99 %u ns\tp99.9 %u ns\tmax %u ns\n",
+           mix->senders, mix->round_trippers, mix->consumers, mix->polling ? ",poll" : "",
+           w->kind, w->index, w->ops, w->elapsed ? w->ops / (w->elapsed / 1e9) : 0,
+           percentile(w, 500), percentile(w, 990), percentile(w, 999), percentile(w, 1000));
+}
+
+static void start(worker_t *w, const char *kind, int index, int ops, void *(*run)(void *))
+{
+    w->kind = kind;
+    w->index = index;
+    w->ops = 0;
+    w->latency = malloc(ops * sizeof(*w->latency));
+    w->elapsed = 0;
+    pthread_create(&w->thread, 0, run, w);
+}
+
+static void run(mock_server_t *server, const mix_t *mix)
+{
+    worker_t workers[MAX_THREADS];
+    xcb_statistics_t before, after;
+    xcb_generic_event_t *event;
+    int i, n = 0, consumers;
+
+    requests_per_sender = mix->senders ? REQUESTS / mix->senders : 0;
+    polling = mix->polling;
+    xcb_get_statistics(c, &before);
+
+    for(i = 0; i < mix->consumers; ++i)
+        start(&workers[n++], "consumer", i, REQUESTS / EVENT_EVERY, consume_events);
+    consumers = n;
+    for(i = 0; i < mix->senders; ++i)
+        start(&workers[n++], "sender", i, requests_per_sender, send_requests);
+    for(i = 0; i < mix->round_trippers; ++i)
+        start(&workers[n++], "round_trip", i, ROUND_TRIPS, round_trip);
+
+    for(i = consumers; i < n; ++i)
+        pthread_join(workers[i].thread, 0);
+    /* the stop events follow the last request's events */
+    free(xcb_get_input_focus_reply(c, xcb_get_input_focus(c), 0));
+    mock_server_flood(server, XCB_KEY_PRESS, consumers);
+    for(i = 0; i < consumers; ++i)
+        pthread_join(workers[i].thread, 0);
+    xcb_get_statistics(c, &after);
+
+    for(i = 0; i < n; ++i)
+    {
+        report(mix, &workers[i]);
+        free(workers[i].latency);
+    }
+    printf("mix=%d,%d,%d%s\tlocks\tout.lock %lu waits %.3f ms\tiolock %lu waits %.3f ms\n",
+           mix->senders, mix->round_trippers, mix->consumers, mix->polling ? ",poll" : "",
+           (unsigned long) (after.out_lock_waits - before.out_lock_waits),
+           (after.out_lock_wait_ns - before.out_lock_wait_ns) / 1e6,
+           (unsigned long) (after.iolock_waits - before.iolock_waits),
+           (after.iolock_wait_ns - before.iolock_wait_ns) / 1e6);
+
+    /* events nobody was left to consume */
+    while((event = xcb_poll_for_event(c)))
+        free(event);
+}
+
+static int parse_mix(const char *arg, mix_t *mix)
+{
+    char mode[5] = "";
+    int n = sscanf(arg, "%d,%d,%d,%4s", &mix->senders, &mix->round_trippers, &mix->consumers, mode);
+    if(n < 3 || mix->senders < 0 || mix->round_trippers < 0 || mix->consumers < 0 ||
+       mix->senders + mix->round_trippers + mix->consumers > MAX_THREADS)
+        return 0;
+    mix->polling = !strcmp(mode, "poll");
+    return n == 3 || mix->polling;
+}
+
+int main(int argc, char **argv)
+{
+    static const mix_t mixes[] = {
+        { 1, 0, 1, 0 }, { 2, 0, 1, 0 }, { 4, 0, 1, 0 }, { 8, 0, 1, 0 }, { 16, 0, 1, 0 },
+        { 1, 0, 1, 1 }, { 2, 0, 1, 1 }, { 4, 0, 1, 1 }, { 8, 0, 1, 1 }, { 16, 0, 1, 1 },
+        { 0, 4, 0, 0 }, { 4, 4, 1, 0 }, { 4, 4, 4, 0 }, { 8, 8, 2, 1 },
+    };
+    mock_server_t *server = mock_server_new();
+    unsigned int requests = 0;
+    int i;
+
+    if(!server)
+        return 1;
+    mock_server_set_handler(server, send_motion, &requests);
+    c = mock_server_connect(server);
+    if(xcb_connection_has_error(c))
+        return 1;
+
+    if(argc > 1)
+        for(i = 1; i < argc; ++i)
+        {
+            mix_t mix;
+            if(!parse_mix(argv[i], &mix))
+            {
+                fprintf(stderr, "usage: %s [senders,round-trippers,consumers[,poll]]...\n", argv[0]);
+                return 1;
+            }
+            run(server, &mix);
+        }
+    else
+        for(i = 0; i < (int) (sizeof(mixes) / sizeof(*mixes)); ++i)
+            run(server, &mixes[i]);
+
+    i = xcb_connection_has_error(c);
+    xcb_disconnect(c);
+    mock_server_free(server);
+    return i ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,94 @@
+/* Measures the cost of collecting, discarding and checking cookies as the
+ * number of outstanding requests grows, against the mock X server from the
+ * tests. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "xcb.h"
+#include "mock_server.h"
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const char *name, int outstanding, double ns, int ops)
+{
+    printf("%s\toutstanding=%d\t%.1f ns/op\n", name, outstanding, ns / ops);
+}
+
+static void sync_connection(xcb_connection_t *c)
+{
+    free(xcb_get_input_focus_reply(c, xcb_get_input_focus(c), 0));
+}
+
+static void run(xcb_connection_t *c, int outstanding)
+{
+    xcb_get_input_focus_cookie_t *cookies = malloc(outstanding * sizeof(*cookies));
+    xcb_void_cookie_t *checked = malloc(outstanding * sizeof(*checked));
+    double start;
+    int i;
+
+    /* collect replies in the order the requests were sent */
+    start = now();
+    for(i = 0; i < outstanding; ++i)
+        cookies[i] = xcb_get_input_focus(c);
+    for(i = 0; i < outstanding; ++i)
+        free(xcb_get_input_focus_reply(c, cookies[i], 0));
+    report("wait_in_order", outstanding, now() - start, outstanding);
+
+    /* collect replies newest first, so all others queue up */
+    start = now();
+    for(i = 0; i < outstanding; ++i)
+        cookies[i] = xcb_get_input_focus(c);
+    for(i = outstanding - 1; i >= 0; --i)
+        free(xcb_get_input_focus_reply(c, cookies[i], 0));
+    report("wait_reversed", outstanding, now() - start, outstanding);
+
+    /* discard replies before they arrive */
+    start = now();
+    for(i = 0; i < outstanding; ++i)
+        cookies[i] = xcb_get_input_focus(c);
+    for(i = outstanding - 1; i >= 0; --i)
+        xcb_discard_reply(c, cookies[i].sequence);
+    sync_connection(c);
+    report("discard", outstanding, now() - start, outstanding);
+
+    /* check void requests for errors */
+    start = now();
+    for(i = 0; i < outstanding; ++i)
+        checked[i] = xcb_no_operation_checked(c);
+    sync_connection(c);
+    for(i = outstanding - 1; i >= 0; --i)
+        free(xcb_request_check(c, checked[i]));
+    report("request_check", outstanding, now() - start, outstanding);
+
+    free(checked);
+    free(cookies);
+}
+
+int main(int argc, char **argv)
+{
+    static const int outstanding[] = { 16, 256, 4096, 32768 };
+    mock_server_t *server = mock_server_new();
+    xcb_connection_t *c;
+    unsigned int i;
+
+    if(!server)
+        return 1;
+    c = mock_server_connect(server);
+    if(xcb_connection_has_error(c))
+        return 1;
+
+    for(i = 0; i < sizeof(outstanding) / sizeof(*outstanding); ++i)
+        run(c, outstanding[i]);
+
+    i = xcb_connection_has_error(c);
+    xcb_disconnect(c);
+    mock_server_free(server);
+    return i ? EXIT_FAILURE : EXIT_SUCCESS;
+}
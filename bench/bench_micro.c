@@ -0,0 +1,277 @@
+/* Microbenchmarks for the request and reply hot paths, against the mock X
+ * server from the tests. Each line of output is one measurement: a name,
+ * the parameter it was run at, nanoseconds per operation and, where the C
+ * library lets malloc be interposed, heap allocations per operation. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "xcb.h"
+#include "xcbext.h"
+#include "xcbint.h"
+#include "mock_server.h"
+
+#define SEND_BATCH 512     /* NoOps that fit in the output queue */
+#define SEND_ROUNDS 2000
+#define XIDS (1 << 20)     /* fewer than the mock's resource_id_mask allows */
+#define LOOKUPS 1000000
+#define READ_ROUNDS 200
+
+/* Allocation counting. Only the thread being measured counts, so the mock
+ * server's allocations stay out of the numbers. */
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static __thread int counting;
+static unsigned long allocations;
+
+void *malloc(size_t size)
+{
+    if(counting)
+        ++allocations;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    if(counting)
+        ++allocations;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if(counting)
+        ++allocations;
+    return __libc_realloc(ptr, size);
+}
+
+#define COUNT_ALLOCATIONS 1
+#else
+static int counting;
+static unsigned long allocations;
+#define COUNT_ALLOCATIONS 0
+#endif
+
+typedef struct {
+    double start;
+    double elapsed;
+    unsigned long allocations;
+} meter_t;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void meter_start(meter_t *meter)
+{
+    allocations = 0;
+    counting = 1;
+    meter->start = now();
+}
+
+static void meter_stop(meter_t *meter)
+{
+    meter->elapsed += now() - meter->start;
+    counting = 0;
+    meter->allocations += allocations;
+}
+
+static void report(const char *name, const char *param, int value, const meter_t *meter, int ops)
+{
+    printf("%s\t%s=%d\t%.1f ns/op", name, param, value, meter->elapsed / ops);
+    if(COUNT_ALLOCATIONS)
+        printf("\t%.3f allocs/op", (double) meter->allocations / ops);
+    printf("\n");
+}
+
+/* xcb_send_request: every batch fits in the output queue and is flushed
+ * outside the measurement, so only encoding and queueing are timed. */
+static void bench_send_request(xcb_connection_t *c)
+{
+    meter_t meter = { 0 };
+    int i, j;
+    for(i = 0; i < SEND_ROUNDS; ++i)
+    {
+        meter_start(&meter);
+        for(j = 0; j < SEND_BATCH; ++j)
+            xcb_no_operation(c);
+        meter_stop(&meter);
+        xcb_flush(c);
+    }
+    report("send_request", "batch", SEND_BATCH, &meter, SEND_ROUNDS * SEND_BATCH);
+}
+
+static void bench_generate_id(xcb_connection_t *c)
+{
+    meter_t meter = { 0 };
+    int i;
+    meter_start(&meter);
+    for(i = 0; i < XIDS; ++i)
+        xcb_generate_id(c);
+    meter_stop(&meter);
+    report("generate_id", "ids", XIDS, &meter, XIDS);
+}
+
+static void bench_extension_data(xcb_connection_t *c)
+{
+    static xcb_extension_t ext = { "MOCK-EXTENSION" };
+    meter_t meter = { 0 };
+    int i;
+    xcb_get_extension_data(c, &ext);
+    meter_start(&meter);
+    for(i = 0; i < LOOKUPS; ++i)
+        xcb_get_extension_data(c, &ext);
+    meter_stop(&meter);
+    report("extension_data", "cached", 1, &meter, LOOKUPS);
+}
+
+/* How many events the mock server sends ahead of each GetInputFocus
+ * reply; only changed between round trips. */
+static volatile int burst_events;
+
+static int send_events(mock_server_t *server, const uint8_t *request, size_t length, uint16_t sequence, void *data)
+{
+    int i, events = burst_events;
+    uint8_t event[32] = { XCB_MOTION_NOTIFY };
+    if(request[0] != XCB_GET_INPUT_FOCUS)
+        return 0;
+    *(uint16_t *) (event + 2) = sequence - 1;
+    for(i = 0; i < events; ++i)
+        if(!mock_server_send(server, event, sizeof(event)))
+            return 0;
+    return 0;
+}
+
+static void round_trips(xcb_connection_t *c, meter_t *meter)
+{
+    xcb_generic_event_t *event;
+    int i;
+    meter_start(meter);
+    for(i = 0; i < READ_ROUNDS; ++i)
+    {
+        free(xcb_get_input_focus_reply(c, xcb_get_input_focus(c), 0));
+        while((event = xcb_poll_for_event(c)))
+            free(event);
+    }
+    meter_stop(meter);
+}
+
+/* read_packet for events: round trips that bring a burst of events along,
+ * less the same round trips without them. */
+static void bench_read_events(xcb_connection_t *c)
+{
+    static const int burst[] = { 16, 256 };
+    meter_t bare = { 0 };
+    unsigned int i;
+
+    round_trips(c, &bare);
+    for(i = 0; i < sizeof(burst) / sizeof(*burst); ++i)
+    {
+        meter_t meter = { 0 };
+        burst_events = burst[i];
+        round_trips(c, &meter);
+        meter.elapsed -= bare.elapsed;
+        meter.allocations -= bare.allocations;
+        report("read_event", "burst", burst[i], &meter, READ_ROUNDS * burst[i]);
+    }
+    burst_events = 0;
+}
+
+/* read_packet for replies: all requests are sent and flushed first, so
+ * the time is spent reading, matching and handing out replies. */
+static void bench_read_replies(xcb_connection_t *c)
+{
+    static const int outstanding[] = { 16, 256, 4096 };
+    unsigned int i;
+    for(i = 0; i < sizeof(outstanding) / sizeof(*outstanding); ++i)
+    {
+        xcb_get_input_focus_cookie_t *cookies = malloc(outstanding[i] * sizeof(*cookies));
+        meter_t meter = { 0 };
+        int j, k;
+        for(j = 0; j < READ_ROUNDS / 10; ++j)
+        {
+            for(k = 0; k < outstanding[i]; ++k)
+                cookies[k] = xcb_get_input_focus(c);
+            xcb_flush(c);
+            meter_start(&meter);
+            for(k = 0; k < outstanding[i]; ++k)
+                free(xcb_get_input_focus_reply(c, cookies[k], 0));
+            meter_stop(&meter);
+        }
+        report("read_reply", "outstanding", outstanding[i], &meter, READ_ROUNDS / 10 * outstanding[i]);
+        free(cookies);
+    }
+}
+
+/* _xcb_map, as the reply and discard tables use it: keys are consecutive
+ * sequence numbers, the oldest is removed as the newest is added, and
+ * lookups hit keys anywhere in the window. */
+static void bench_map(void)
+{
+    static const int outstanding[] = { 16, 256, 4096, 65536 };
+    static char value;
+    unsigned int i;
+    for(i = 0; i < sizeof(outstanding) / sizeof(*outstanding); ++i)
+    {
+        _xcb_map *map = _xcb_map_new();
+        meter_t get = { 0 }, churn = { 0 };
+        unsigned int n = outstanding[i], key, next = 1;
+        int j;
+
+        for(; next <= n; ++next)
+            _xcb_map_put(map, next, &value);
+
+        meter_start(&get);
+        for(j = 0, key = 0; j < LOOKUPS; ++j, key += 7919)
+            _xcb_map_get(map, next - n + key % n);
+        meter_stop(&get);
+        report("map_get", "outstanding", n, &get, LOOKUPS);
+
+        meter_start(&churn);
+        for(j = 0; j < LOOKUPS; ++j, ++next)
+        {
+            _xcb_map_remove(map, next - n);
+            _xcb_map_put(map, next, &value);
+        }
+        meter_stop(&churn);
+        report("map_remove_put", "outstanding", n, &churn, LOOKUPS);
+
+        _xcb_map_delete(map, 0);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    mock_server_t *server = mock_server_new();
+    xcb_connection_t *c;
+    int ret;
+
+    if(!server)
+        return EXIT_FAILURE;
+    mock_server_add_extension(server, "MOCK-EXTENSION", 150, 100, 200);
+    mock_server_set_handler(server, send_events, 0);
+    c = mock_server_connect(server);
+    if(xcb_connection_has_error(c))
+        return EXIT_FAILURE;
+
+    bench_send_request(c);
+    bench_generate_id(c);
+    bench_extension_data(c);
+    bench_read_events(c);
+    bench_read_replies(c);
+    bench_map();
+
+    ret = xcb_connection_has_error(c);
+    xcb_disconnect(c);
+    mock_server_free(server);
+    return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,319 @@
+/* Replays a wire capture as a benchmark. A capture is written by any XCB
+ * client run with XCB_CAPTURE_FILE set; with no capture named on the
+ * command line, this first records one of its own against the mock X
+ * server from the tests. The replaying X server is a thread on the other
+ * end of a socketpair that plays back the recorded server bytes, waiting
+ * for the client's bytes at the points they were recorded, while this
+ * thread sends the recorded client bytes through xcb_writev and reads
+ * events until the server hangs up. */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "xcb.h"
+#include "xcbext.h"
+#include "xcb_capture.h"
+#include "mock_server.h"
+
+#define ITERATIONS 20
+#define RECORD_ROUNDS 2000
+#define RECORD_BATCH 16
+
+static int read_all(int fd, void *buf, size_t len)
+{
+    size_t done = 0;
+    while(done < len)
+    {
+        ssize_t ret = read(fd, (char *) buf + done, len - done);
+        if(ret < 0 && errno == EINTR)
+            continue;
+        if(ret <= 0)
+            return 0;
+        done += ret;
+    }
+    return 1;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+    size_t done = 0;
+    while(done < len)
+    {
+        ssize_t ret = write(fd, (const char *) buf + done, len - done);
+        if(ret < 0 && errno == EINTR)
+            continue;
+        if(ret <= 0)
+            return 0;
+        done += ret;
+    }
+    return 1;
+}
+
+static int skip_all(int fd, size_t len)
+{
+    char buf[4096];
+    while(len)
+    {
+        size_t cur = len < sizeof(buf) ? len : sizeof(buf);
+        if(!read_all(fd, buf, cur))
+            return 0;
+        len -= cur;
+    }
+    return 1;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Length of the setup request that starts with these 12 bytes. */
+static size_t setup_request_length(const uint8_t *header)
+{
+    size_t namelen = *(const uint16_t *) (header + 6);
+    size_t datalen = *(const uint16_t *) (header + 8);
+    return 12 + namelen + XCB_TYPE_PAD(uint32_t, namelen) + datalen + XCB_TYPE_PAD(uint32_t, datalen);
+}
+
+/* Recording: the mock server sends a MotionNotify after every
+ * RECORD_BATCH NoOps. */
+
+static int send_motion(mock_server_t *server, const uint8_t *request, size_t length, uint16_t sequence, void *data)
+{
+    unsigned int *requests = data;
+    uint8_t event[32] = { XCB_MOTION_NOTIFY };
+    if(request[0] != XCB_NO_OPERATION)
+        return 0;
+    if(++*requests % RECORD_BATCH)
+        return 1;
+    *(uint16_t *) (event + 2) = sequence;
+    return mock_server_send(server, event, sizeof(event));
+}
+
+static int record(const char *path)
+{
+    mock_server_t *server = mock_server_new();
+    unsigned int requests = 0;
+    xcb_connection_t *c;
+    int i, j;
+
+    if(!server)
+        return 0;
+    mock_server_set_handler(server, send_motion, &requests);
+    setenv("XCB_CAPTURE_FILE", path, 1);
+    c = mock_server_connect(server);
+    unsetenv("XCB_CAPTURE_FILE");
+
+    for(i = 0; i < RECORD_ROUNDS && !xcb_connection_has_error(c); ++i)
+    {
+        xcb_generic_event_t *event;
+        for(j = 0; j < RECORD_BATCH; ++j)
+            xcb_no_operation(c);
+        free(xcb_get_input_focus_reply(c, xcb_get_input_focus(c), 0));
+        while((event = xcb_poll_for_event(c)))
+            free(event);
+    }
+
+    i = !xcb_connection_has_error(c);
+    xcb_disconnect(c);
+    mock_server_free(server);
+    return i;
+}
+
+/* Replaying */
+
+typedef struct {
+    const uint8_t *begin;
+    const uint8_t *end;
+    size_t setup_length;
+    int fd;
+} capture_t;
+
+#define FIRST_RECORD(capture) ((capture)->begin + sizeof(xcb_capture_header_t))
+#define NEXT_RECORD(record) ((const uint8_t *) ((record) + 1) + (record)->length + XCB_CAPTURE_PAD((record)->length))
+
+static int open_capture(capture_t *capture, const char *path)
+{
+    const xcb_capture_header_t *header;
+    const xcb_capture_record_t *record;
+    struct stat st;
+    void *map;
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return 0;
+    if(fstat(fd, &st) || st.st_size < (off_t) sizeof(*header))
+    {
+        close(fd);
+        return 0;
+    }
+    map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return 0;
+    capture->begin = map;
+    capture->end = capture->begin + st.st_size;
+
+    header = map;
+    record = (const xcb_capture_record_t *) FIRST_RECORD(capture);
+    if(memcmp(header->magic, XCB_CAPTURE_MAGIC, sizeof(header->magic)) ||
+       header->byte_order != XCB_CAPTURE_BYTE_ORDER ||
+       (const uint8_t *) (record + 1) > capture->end ||
+       record->direction != XCB_CAPTURE_WRITE || record->length < 12)
+    {
+        munmap(map, st.st_size);
+        return 0;
+    }
+    capture->setup_length = setup_request_length((const uint8_t *) (record + 1));
+    return 1;
+}
+
+static void *serve_capture(void *arg)
+{
+    const capture_t *capture = arg;
+    const uint8_t *pos;
+    uint8_t setup_request[12];
+    size_t skip = capture->setup_length;
+
+    /* the live setup request need not match the recorded one */
+    if(!read_all(capture->fd, setup_request, sizeof(setup_request)) ||
+       !skip_all(capture->fd, setup_request_length(setup_request) - sizeof(setup_request)))
+        return 0;
+
+    for(pos = FIRST_RECORD(capture); pos < capture->end; )
+    {
+        const xcb_capture_record_t *record = (const xcb_capture_record_t *) pos;
+        if(record->direction == XCB_CAPTURE_WRITE)
+        {
+            size_t done = record->length < skip ? record->length : skip;
+            skip -= done;
+            if(!skip_all(capture->fd, record->length - done))
+                break;
+        }
+        else if(!write_all(capture->fd, record + 1, record->length))
+            break;
+        pos = NEXT_RECORD(record);
+    }
+
+    /* hang up, then let the client finish */
+    shutdown(capture->fd, SHUT_WR);
+    while(skip_all(capture->fd, 1))
+        /* empty */;
+    close(capture->fd);
+    return 0;
+}
+
+static void return_socket(void *closure)
+{
+}
+
+static double replay(capture_t *capture, size_t *bytes)
+{
+    xcb_connection_t *c;
+    xcb_generic_event_t *event;
+    pthread_t server;
+    const uint8_t *pos;
+    uint64_t sent, last = 0;
+    size_t skip = capture->setup_length;
+    double start;
+    int sv[2];
+
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+        return -1;
+    capture->fd = sv[1];
+    if(pthread_create(&server, 0, serve_capture, capture))
+        return -1;
+
+    start = now();
+    c = xcb_connect_to_fd(sv[0], 0);
+    if(!xcb_take_socket(c, return_socket, 0, XCB_REQUEST_DISCARD_REPLY, &sent))
+        fprintf(stderr, "bench_replay: could not take the socket\n");
+
+    *bytes = 0;
+    for(pos = FIRST_RECORD(capture); pos < capture->end && !xcb_connection_has_error(c); )
+    {
+        const xcb_capture_record_t *record = (const xcb_capture_record_t *) pos;
+        pos = NEXT_RECORD(record);
+        if(record->direction == XCB_CAPTURE_READ)
+        {
+            *bytes += record->length;
+            continue;
+        }
+        {
+            struct iovec vec;
+            size_t done = record->length < skip ? record->length : skip;
+            skip -= done;
+            if(done == record->length)
+                continue;
+            vec.iov_base = (char *) (record + 1) + done;
+            vec.iov_len = record->length - done;
+            xcb_writev(c, &vec, 1, record->sequence - last);
+            last = record->sequence;
+        }
+    }
+    while((event = xcb_wait_for_event(c)))
+        free(event);
+
+    start = now() - start;
+    xcb_disconnect(c);
+    pthread_join(server, 0);
+    return start;
+}
+
+int main(int argc, char **argv)
+{
+    char path[] = "/tmp/bench_replay.XXXXXX";
+    const char *name = argv[1];
+    capture_t capture;
+    double total = 0, best = 0;
+    size_t bytes = 0;
+    int i;
+
+    if(!name)
+    {
+        int fd = mkstemp(path);
+        if(fd < 0)
+            return EXIT_FAILURE;
+        close(fd);
+        name = path;
+        if(!record(name))
+        {
+            unlink(path);
+            return EXIT_FAILURE;
+        }
+    }
+    if(!open_capture(&capture, name))
+    {
+        if(name == path)
+            unlink(path);
+        /* libxcb configured with --disable-tracing writes no captures */
+        fprintf(stderr, "bench_replay: %s is not a capture\n", name);
+        return name == path ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if(name == path)
+        unlink(path);
+
+    for(i = 0; i < ITERATIONS; ++i)
+    {
+        double t = replay(&capture, &bytes);
+        if(t < 0)
+            return EXIT_FAILURE;
+        total += t;
+        if(!best || t < best)
+            best = t;
+    }
+
+    printf("replay\tbytes=%lu\tmean %.1f us\tbest %.1f us\t%.1f ns/byte\n",
+           (unsigned long) bytes, total / ITERATIONS / 1e3, best / 1e3, best / bytes);
+    return EXIT_SUCCESS;
+}
@@ -257,6 +257,40 @@ void xcb_prefetch_maximum_request_length(xcb_connection_t *c);
  */
 xcb_generic_event_t *xcb_wait_for_event(xcb_connection_t *c);
 
+/**
+ * @brief Returns a file descriptor that is readable while events are queued.
+ * @param c: The connection to the X server.
+ * @return The file descriptor, or -1 on failure.
+ *
+ * Events may be read from the socket as a side effect of waiting for a
+ * reply, leaving them queued while the socket itself is no longer
+ * readable. The returned descriptor, an eventfd where available and the
+ * read end of a pipe otherwise, is readable whenever at least one event
+ * is queued. It may stay readable for a moment after another thread
+ * takes the last event, so xcb_poll_for_event returning null after a
+ * wakeup is not an error. Event loops can watch it next to
+ * xcb_get_file_descriptor and call xcb_poll_for_event only when one of
+ * the two is readable.
+ *
+ * Do not read from or close the descriptor; it belongs to the
+ * connection and is closed by xcb_disconnect.
+ */
+int xcb_get_event_fd(xcb_connection_t *c);
+
+/**
+ * @brief Returns the next event or error, waiting at most a given time.
+ * @param c: The connection to the X server.
+ * @param timeout: The longest time to wait, in milliseconds; negative
+ * to wait forever.
+ * @return The next event from the server, or NULL.
+ *
+ * Like xcb_wait_for_event, but returns NULL when @p timeout
+ * milliseconds pass without an event. Use xcb_connection_has_error to
+ * tell a timeout from an I/O error. With a @p timeout of 0, reads what
+ * is available without blocking, like xcb_poll_for_event.
+ */
+xcb_generic_event_t *xcb_wait_for_event_timeout(xcb_connection_t *c, int timeout);
+
 /**
  * @brief Returns the next event or error from the server.
  * @param c: The connection to the X server.
@@ -271,6 +305,222 @@ xcb_generic_event_t *xcb_wait_for_event(xcb_connection_t *c);
  */
 xcb_generic_event_t *xcb_poll_for_event(xcb_connection_t *c);
 
+/**
+ * @brief Returns the next event or error that has already been read.
+ * @param c: The connection to the X server.
+ * @return The next queued event from the server.
+ *
+ * Like xcb_poll_for_event, but only examines the events that XCB has
+ * already read from the server; it never reads from the connection's
+ * file descriptor. Returns @c NULL if no event is queued.
+ *
+ * This is intended for event loops that watch the file descriptor
+ * themselves and need to drain events that were read while waiting
+ * for a reply.
+ */
+xcb_generic_event_t *xcb_poll_for_queued_event(xcb_connection_t *c);
+
+/**
+ * @brief Looks at the next queued event without removing it.
+ * @param c: The connection to the X server.
+ * @param event: Receives a copy of the event.
+ * @return 1 if an event was copied, 0 if no event is queued.
+ *
+ * Copies the event that xcb_poll_for_queued_event would return next
+ * into @p event, leaving it queued. Like xcb_poll_for_queued_event,
+ * this never reads from the connection. Only the first
+ * sizeof(xcb_generic_event_t) bytes are copied, so the data following
+ * an XGE event is not included.
+ */
+int xcb_peek_event(xcb_connection_t *c, xcb_generic_event_t *event);
+
+/**
+ * @brief Returns a batch of events or errors from the server.
+ * @param c: The connection to the X server.
+ * @param events: Array that receives the events.
+ * @param max: The number of entries available in @p events.
+ * @return The number of events stored in @p events.
+ *
+ * Like xcb_wait_for_event, but stores up to @p max events that are
+ * already queued, taking the connection's lock only once. Blocks
+ * until at least one event or error arrives, or an I/O error occurs,
+ * in which case 0 is returned.
+ */
+int xcb_wait_for_events(xcb_connection_t *c, xcb_generic_event_t **events, int max);
+
+/**
+ * @brief Returns a batch of events or errors from the server.
+ * @param c: The connection to the X server.
+ * @param events: Array that receives the events.
+ * @param max: The number of entries available in @p events.
+ * @return The number of events stored in @p events.
+ *
+ * Like xcb_poll_for_event, but stores up to @p max available events,
+ * taking the connection's lock only once. Returns 0 if no event is
+ * available.
+ */
+int xcb_poll_for_events(xcb_connection_t *c, xcb_generic_event_t **events, int max);
+
+/**
+ * @brief How queued events of one type are combined with newer ones.
+ */
+typedef enum xcb_event_coalescing_t {
+    /** Queue every event (the default). */
+    XCB_COALESCE_NONE = 0,
+    /** Drop the queued event and queue the newer one. */
+    XCB_COALESCE_REPLACE,
+    /** Ask a callback to fold the newer event into the queued one. */
+    XCB_COALESCE_MERGE
+} xcb_event_coalescing_t;
+
+/**
+ * @brief Callback that folds an event into an older queued one.
+ * @param queued: The queued event, which may be modified.
+ * @param event: The newly arrived event.
+ * @param data: The data pointer given to xcb_set_event_coalescing.
+ * @return Non-zero if @p event was folded into @p queued and should be
+ * dropped; 0 to queue @p event as well.
+ *
+ * Called with the connection locked, so it must not call back into XCB.
+ */
+typedef int (*xcb_event_merge_func_t)(xcb_generic_event_t *queued, const xcb_generic_event_t *event, void *data);
+
+/**
+ * @brief Sets how floods of one event type are coalesced.
+ * @param c: The connection to the X server.
+ * @param response_type: The event type; for extension events, the
+ * extension's first_event plus the event number.
+ * @param policy: The coalescing policy for this event type.
+ * @param key_offset: Byte offset of the 32-bit field, usually a window
+ * or drawable, that identifies events which may supersede each other.
+ * @param merge: The callback for XCB_COALESCE_MERGE, or @c NULL.
+ * @param data: Passed to @p merge.
+ * @return 1 on success, 0 on invalid arguments or allocation failure.
+ *
+ * When an event of type @p response_type arrives while an older event
+ * of the same type and the same key is still queued, the two are
+ * combined according to @p policy instead of both being queued. Use
+ * this to bound queue growth under floods of MotionNotify, Expose,
+ * ConfigureNotify or DamageNotify events: for instance, with
+ * XCB_COALESCE_REPLACE and a key_offset of 8, only the newest
+ * ConfigureNotify for each window stays queued.
+ *
+ * Events sent with SendEvent, errors and XGE events are never
+ * coalesced. XCB_COALESCE_NONE turns coalescing off again.
+ */
+int xcb_set_event_coalescing(xcb_connection_t *c, uint8_t response_type, xcb_event_coalescing_t policy, unsigned int key_offset, xcb_event_merge_func_t merge, void *data);
+
+/**
+ * @brief Callback that receives events as soon as they are read.
+ * @param event: The event or error. Only valid during the call.
+ * @param data: The data pointer given when the handler was set.
+ * @return Non-zero if the event was handled; 0 to queue it as usual.
+ *
+ * Called with the connection locked, so it must not call back into XCB.
+ */
+typedef int (*xcb_event_handler_t)(const xcb_generic_event_t *event, void *data);
+
+/**
+ * @brief Sets the handler for one core event type, or for errors.
+ * @param c: The connection to the X server.
+ * @param response_type: The event type, or 0 for unchecked errors.
+ * @param handler: The handler, or @c NULL to remove it.
+ * @param data: Passed to @p handler.
+ * @return 1 on success, 0 on invalid arguments or allocation failure.
+ *
+ * Events of type @p response_type, including those sent with SendEvent,
+ * are passed to @p handler from whichever thread reads them from the
+ * socket, before they are queued. Events the handler accepts are never
+ * returned by xcb_wait_for_event or xcb_poll_for_event, and plain
+ * 32-byte events are handed over without allocating a copy.
+ *
+ * Use xcb_dispatch_events to read without waiting for an event, and
+ * xcb_set_extension_event_handler or xcb_set_ge_event_handler for
+ * extension events.
+ */
+int xcb_set_event_handler(xcb_connection_t *c, uint8_t response_type, xcb_event_handler_t handler, void *data);
+
+/**
+ * @brief Reads whatever the server has sent, without blocking.
+ * @param c: The connection to the X server.
+ * @return 1 on success, 0 if the connection has shut down.
+ *
+ * Runs the handlers set with xcb_set_event_handler for every event
+ * that is already available and queues the rest.
+ */
+int xcb_dispatch_events(xcb_connection_t *c);
+
+/**
+ * @brief Allocates a buffer for a reply, error or event.
+ * @param size: The number of bytes needed.
+ * @param data: The data pointer given to xcb_set_allocator.
+ * @return The buffer, or @c NULL on failure.
+ *
+ * Called with the connection locked, so it must not call back into XCB.
+ */
+typedef void *(*xcb_alloc_func_t)(size_t size, void *data);
+
+/**
+ * @brief Frees a buffer returned by an xcb_alloc_func_t.
+ * @param ptr: The buffer.
+ * @param data: The data pointer given to xcb_set_allocator.
+ */
+typedef void (*xcb_free_func_t)(void *ptr, void *data);
+
+/**
+ * @brief Sets the allocator for replies, errors and events.
+ * @param c: The connection to the X server.
+ * @param alloc: The allocation function, or @c NULL for malloc.
+ * @param release: The matching free function, or @c NULL for free.
+ * @param data: Passed to @p alloc and @p release.
+ * @return 1 on success, 0 if requests were already sent or only one of
+ * @p alloc and @p release was given.
+ *
+ * Every reply, error and event that XCB hands to the application is then
+ * allocated with @p alloc, and must be released with @p release (or,
+ * for events, xcb_release_event) instead of free(). Since buffers must go
+ * back to the allocator that made them, this must be called before the
+ * first request is sent.
+ */
+int xcb_set_allocator(xcb_connection_t *c, xcb_alloc_func_t alloc, xcb_free_func_t release, void *data);
+
+/**
+ * @brief Reads the reply to a request straight into the caller's memory.
+ * @param c: The connection to the X server.
+ * @param sequence: The request sequence number from a cookie.
+ * @param buffer: Where to store the reply.
+ * @param size: The size of @p buffer in bytes.
+ * @return 1 if @p buffer will be used, 0 if the reply may already have
+ * arrived or on allocation failure.
+ *
+ * If the first reply to request @p sequence fits in @p size bytes, XCB
+ * reads it directly into @p buffer, and the reply function for the
+ * request returns @p buffer itself. This avoids allocating and copying
+ * very large replies, such as GetImage, again for every frame. A reply
+ * that does not fit is allocated as usual.
+ *
+ * Check whether the reply function returned @p buffer before freeing
+ * the reply: @p buffer stays the caller's. It must stay valid until the
+ * reply has been collected or discarded.
+ */
+int xcb_set_reply_buffer(xcb_connection_t *c, unsigned int sequence, void *buffer, size_t size);
+
+/**
+ * @brief Gives an event back to the connection for reuse.
+ * @param c: The connection to the X server.
+ * @param event: An event returned for @p c, or @c NULL.
+ *
+ * Equivalent to free(@p event), except that the buffer is kept by the
+ * connection and used for a later event or error instead of being
+ * returned to the system allocator. Applications that handle many
+ * events should prefer this to free().
+ *
+ * @p event must have been returned by xcb_wait_for_event or
+ * xcb_poll_for_event on the same connection; never pass a reply or a
+ * buffer you allocated yourself.
+ */
+void xcb_release_event(xcb_connection_t *c, xcb_generic_event_t *event);
+
 /**
  * @brief Return the error for a request, or NULL if none can ever arrive.
  * @param c: The connection to the X server.
@@ -289,6 +539,21 @@ xcb_generic_event_t *xcb_poll_for_event(xcb_connection_t *c);
  */
 xcb_generic_error_t *xcb_request_check(xcb_connection_t *c, xcb_void_cookie_t cookie);
 
+/**
+ * @brief Collect the errors for many checked requests at once.
+ * @param c: The connection to the X server.
+ * @param cookies: The request cookies.
+ * @param n: The number of cookies.
+ * @param errors: Receives the error, or NULL, for each cookie.
+ * @return The number of requests that failed.
+ *
+ * Does what calling xcb_request_check on each cookie would do, but with
+ * at most one round trip: a single sync after the last of the cookies,
+ * and none if a request with a reply was already sent after it. Each
+ * error stored in @p errors must be freed by the caller.
+ */
+int xcb_request_check_many(xcb_connection_t *c, const xcb_void_cookie_t *cookies, unsigned int n, xcb_generic_error_t **errors);
+
 /**
  * @brief Discards the reply for a request.
  * @param c: The connection to the X server.
@@ -331,6 +596,36 @@ typedef struct xcb_extension_t xcb_extension_t;  /**< Opaque structure used as k
  */
 const xcb_query_extension_reply_t *xcb_get_extension_data(xcb_connection_t *c, xcb_extension_t *ext);
 
+/**
+ * @brief Sets the handler for one event of an extension.
+ * @param c: The connection.
+ * @param ext: The extension data.
+ * @param event: The event number within the extension.
+ * @param handler: The handler, or @c NULL to remove it.
+ * @param data: Passed to @p handler.
+ * @return 1 on success, 0 if the extension is missing or the arguments
+ * are invalid.
+ *
+ * Like xcb_set_event_handler, with the response type computed from the
+ * extension's first_event. May block in xcb_get_extension_data.
+ */
+int xcb_set_extension_event_handler(xcb_connection_t *c, xcb_extension_t *ext, uint8_t event, xcb_event_handler_t handler, void *data);
+
+/**
+ * @brief Sets the handler for one XGE event of an extension.
+ * @param c: The connection.
+ * @param ext: The extension data.
+ * @param event_type: The event_type field of the XGE events.
+ * @param handler: The handler, or @c NULL to remove it.
+ * @param data: Passed to @p handler.
+ * @return 1 on success, 0 if the extension is missing or on allocation
+ * failure.
+ *
+ * Like xcb_set_event_handler, for GenericEvents sent by @p ext. May
+ * block in xcb_get_extension_data.
+ */
+int xcb_set_ge_event_handler(xcb_connection_t *c, xcb_extension_t *ext, uint16_t event_type, xcb_event_handler_t handler, void *data);
+
 /**
  * @brief Prefetch of extension data into the extension cache
  * @param c: The connection.
@@ -377,6 +672,27 @@ const xcb_setup_t *xcb_get_setup(xcb_connection_t *c);
  */
 int xcb_get_file_descriptor(xcb_connection_t *c);
 
+/**
+ * @brief Starts a thread that reads everything the server sends.
+ * @param c: The connection.
+ * @return 1 on success, 0 if the connection has shut down or the thread
+ * could not be created.
+ *
+ * By default, whichever thread blocks in XCB first reads from the
+ * socket on behalf of all others, and hands that job on to the next
+ * waiter when its own reply or event arrives. With a reader thread,
+ * threads blocked on replies or events only sleep until the reader
+ * thread wakes exactly the ones whose reply or event has arrived.
+ * This makes reply latency steadier when many threads wait on the
+ * same connection.
+ *
+ * Event handlers set with xcb_set_event_handler then run on the reader
+ * thread. The thread exits when the connection shuts down and is
+ * joined by xcb_disconnect. Calling this more than once has no further
+ * effect.
+ */
+int xcb_enable_reader_thread(xcb_connection_t *c);
+
 /**
  * @brief Test whether the connection has shut down due to a fatal error.
  * @param c: The connection.
@@ -479,6 +795,205 @@ xcb_connection_t *xcb_connect_to_display_with_auth_info(const char *display, xcb
 uint32_t xcb_generate_id(xcb_connection_t *c);
 
 
+/* xcb_stats.c */
+
+/**
+ * @brief Counters describing what a connection has done so far.
+ *
+ * Filled in by xcb_get_statistics. Counts are totals since the
+ * connection was made; depths are the state at the time of the call.
+ */
+typedef struct xcb_statistics_t {
+    uint64_t requests_sent;     /**< Requests queued, including injected syncs. */
+    uint64_t bytes_written;     /**< Bytes written to the server. */
+    uint64_t bytes_read;        /**< Bytes read from the server. */
+    uint64_t flushes;           /**< Times the output queue was flushed. */
+    uint64_t writev_calls;      /**< Successful writev calls. */
+    uint64_t round_trips;       /**< Waits for a reply that had to block. */
+    uint64_t syncs_injected;    /**< GetInputFocus requests sent by xcb_send_request to keep sequence numbers in step. */
+    uint64_t events_queued;     /**< Events and errors put on the event queue. */
+    uint64_t xid_refills;       /**< XID ranges obtained, including the initial one. */
+    uint64_t out_lock_waits;    /**< Times a thread found the output lock taken. */
+    uint64_t out_lock_wait_ns;  /**< Nanoseconds spent waiting for it. */
+    uint64_t iolock_waits;      /**< Times a thread found the input lock taken. */
+    uint64_t iolock_wait_ns;    /**< Nanoseconds spent waiting for it. */
+    unsigned int event_queue_depth; /**< Events now queued. */
+    unsigned int event_queue_peak;  /**< Most events ever queued at once. */
+    unsigned int reply_queue_depth; /**< Replies and errors read but not yet claimed. */
+    unsigned int reply_queue_peak;  /**< Most replies ever waiting at once. */
+} xcb_statistics_t;
+
+/**
+ * @brief Reads the connection's counters.
+ * @param c: The connection.
+ * @param stats: Receives the counters.
+ *
+ * The counters are kept as the connection works and cost little
+ * enough to leave on; this only copies them. Each side of the
+ * connection is read under its own lock, so the values are consistent
+ * within the output side and within the input side but not
+ * necessarily between them.
+ *
+ * Lock waits are timed only when a lock is found taken, and do not
+ * include time a thread spends asleep waiting for the server after
+ * giving up the input lock.
+ *
+ * A connection that has failed keeps the counters it had when it
+ * failed, until xcb_disconnect; one that failed to be made has all of
+ * them 0.
+ */
+void xcb_get_statistics(xcb_connection_t *c, xcb_statistics_t *stats);
+
+/**
+ * @brief How long each step of making a connection took, in nanoseconds.
+ *
+ * Filled in by xcb_get_connect_timings. The first three steps are only
+ * taken by xcb_connect and xcb_connect_to_display_with_auth_info, and are
+ * 0 for connections made with xcb_connect_to_fd; auth_ns is also 0 when
+ * the caller supplied the authorization.
+ */
+typedef struct xcb_connect_timings_t {
+    uint64_t parse_display_ns;  /**< Parsing the display name. */
+    uint64_t open_ns;           /**< Opening the socket, trying each kind in turn. */
+    uint64_t auth_ns;           /**< Finding authorization, which reads Xauthority. */
+    uint64_t write_setup_ns;    /**< Sending the connection setup request. */
+    uint64_t read_setup_ns;     /**< Waiting for and reading the server's setup. */
+    uint64_t ext_init_ns;       /**< Setting up the extension cache. */
+    uint64_t xid_init_ns;       /**< Setting up XID allocation. */
+    uint64_t total_ns;          /**< From start to finish, including the rest. */
+} xcb_connect_timings_t;
+
+/**
+ * @brief Reads how long the connection took to make.
+ * @param c: The connection.
+ * @param timings: Receives the timings.
+ *
+ * The timings are taken once, while connecting, and never change
+ * afterwards, even if the connection later fails. A connection that
+ * failed to be made has all of them 0.
+ */
+void xcb_get_connect_timings(xcb_connection_t *c, xcb_connect_timings_t *timings);
+
+/** Number of buckets in an xcb_request_latency_t histogram. */
+#define XCB_LATENCY_BUCKETS 24
+
+/**
+ * @brief Round-trip latencies for one kind of request.
+ *
+ * Filled in by xcb_get_request_latency. Bucket 0 counts replies that
+ * took under a microsecond; bucket i, for 0 < i < XCB_LATENCY_BUCKETS - 1,
+ * those that took at least 2^(i-1) and under 2^i microseconds; the
+ * last bucket counts everything slower.
+ */
+typedef struct xcb_request_latency_t {
+    const char *extension;  /**< Extension name, or NULL for core requests. */
+    uint8_t major_opcode;   /**< Major opcode as last sent to this server. */
+    uint8_t minor_opcode;   /**< Minor opcode for extension requests, else 0. */
+    uint64_t count;         /**< Requests whose first reply or error arrived. */
+    uint64_t total_ns;      /**< Sum of their latencies, in nanoseconds. */
+    uint64_t bytes_sent;    /**< Bytes of those requests. */
+    uint64_t bytes_received; /**< Bytes of their first replies. */
+    uint64_t buckets[XCB_LATENCY_BUCKETS]; /**< The histogram. */
+} xcb_request_latency_t;
+
+/**
+ * @brief Starts timing requests that have replies.
+ * @param c: The connection.
+ * @return 1 on success, 0 otherwise.
+ *
+ * From now on, every request sent with a reply is timed from the moment
+ * it is queued until its first reply or error is read, and the result
+ * is added to a histogram for its opcode. Timing costs a clock read and
+ * a short critical section per request, so it is off until this is
+ * called and cannot be turned off again.
+ */
+int xcb_enable_request_latency(xcb_connection_t *c);
+
+/**
+ * @brief Reads the request latency histograms.
+ * @param c: The connection.
+ * @param latency: Receives up to @p max histograms.
+ * @param max: Room in @p latency.
+ * @return The number of histograms there are, which may exceed @p max.
+ *
+ * Histograms are in the order their request types were first sent.
+ * Extension requests are reported by extension name and minor opcode,
+ * so reports compare across servers that assign different major opcodes.
+ */
+int xcb_get_request_latency(xcb_connection_t *c, xcb_request_latency_t *latency, int max);
+
+
+/* xcb_trace.c */
+
+/**
+ * @brief Points in a connection's work that a trace hook is told about.
+ */
+typedef enum xcb_trace_point_t {
+    XCB_TRACE_REQUEST,  /**< xcb_send_request gave a request its sequence number. */
+    XCB_TRACE_WRITE,    /**< Bytes were written to the server. */
+    XCB_TRACE_REPLY,    /**< A reply was read. */
+    XCB_TRACE_EVENT,    /**< An event was read. */
+    XCB_TRACE_ERROR,    /**< An error was read. */
+    XCB_TRACE_BLOCK,    /**< A thread is about to block waiting for I/O or for another thread. */
+    XCB_TRACE_RESUME    /**< That thread is running again. */
+} xcb_trace_point_t;
+
+/**
+ * @brief What a trace hook is told.
+ *
+ * The opcodes depend on the point. Requests carry their major opcode,
+ * and their minor opcode if they belong to an extension. Errors carry
+ * the opcodes of the request that failed. Events carry their
+ * response_type and, for GenericEvents, their event_type. The rest
+ * carry zeros.
+ */
+typedef struct xcb_trace_record_t {
+    xcb_trace_point_t point; /**< Where the connection is. */
+    uint64_t sequence;      /**< The request, reply, event or error's sequence number. For writes and blocking, the newest request queued (writers) or read (readers). */
+    uint8_t major_opcode;   /**< See above. */
+    uint16_t minor_opcode;  /**< See above. */
+    uint32_t size;          /**< Bytes in the request, packet or write. */
+    uint64_t timestamp;     /**< CLOCK_MONOTONIC, in nanoseconds. */
+    const void *data;       /**< The request's first iovec, or the packet's first 32 bytes; NULL otherwise. Only valid during the call. */
+} xcb_trace_record_t;
+
+/**
+ * @brief Called at each trace point.
+ * @param record: What happened.
+ * @param data: The data pointer given to xcb_set_trace_hook.
+ *
+ * Hooks run on whichever thread reached the point, with one of the
+ * connection's locks held. They must be quick and must not call back
+ * into XCB on the same connection.
+ */
+typedef void (*xcb_trace_func_t)(const xcb_trace_record_t *record, void *data);
+
+/**
+ * @brief Sets the connection's trace hook.
+ * @param c: The connection.
+ * @param hook: The hook, or NULL to stop tracing.
+ * @param data: Passed to @p hook.
+ * @return 1 on success, 0 if tracing was compiled out or the connection has failed.
+ *
+ * A connection has at most one hook; setting another replaces it.
+ * Without a hook, each trace point costs one test of a pointer, and a
+ * libxcb configured with --disable-tracing has no trace points at all.
+ *
+ * If the XCB_TRACE_FILE environment variable names a file when a
+ * connection is made, the connection starts with a hook that writes
+ * its requests, writes, replies, events, errors and blocking waits
+ * there as Chrome trace-event JSON, one timeline per thread, for
+ * chrome://tracing or Perfetto. All connections in a process share the
+ * file, which is complete once the last of them is disconnected.
+ *
+ * Similarly, XCB_CAPTURE_FILE names a file to receive a timestamped copy
+ * of every byte the connection writes and reads, for replay by
+ * bench_replay. Later connections in the process append ".2", ".3" and
+ * so on to the name.
+ */
+int xcb_set_trace_hook(xcb_connection_t *c, xcb_trace_func_t hook, void *data);
+
+
 /**
  * @}
  */
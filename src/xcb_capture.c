@@ -0,0 +1,117 @@
+/* Copyright (C) 2001-2008 Bart Massey and Jamey Sharp.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * Except as contained in this notice, the names of the authors or their
+ * institutions shall not be used in advertising or otherwise to promote the
+ * sale, use or other dealings in this Software without prior written
+ * authorization from the authors.
+ */
+
+/* Wire capture: a copy of every byte exchanged with the server. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xcb.h"
+#include "xcbint.h"
+#include "xcb_capture.h"
+
+#if XCB_TRACING
+static pthread_mutex_t capture_lock = PTHREAD_MUTEX_INITIALIZER;
+static int capture_connections;
+#endif
+
+/* Private interface */
+
+/* Opens $XCB_CAPTURE_FILE for the process's first connection, and the
+ * same name with ".2", ".3" and so on appended for later ones, so each
+ * file holds one connection's byte streams. */
+void _xcb_capture_init(xcb_connection_t *c)
+{
+#if XCB_TRACING
+    const char *name = getenv("XCB_CAPTURE_FILE");
+    xcb_capture_header_t header;
+    char *path;
+    int connection;
+    if(!name || !*name)
+        return;
+
+    pthread_mutex_lock(&capture_lock);
+    connection = ++capture_connections;
+    pthread_mutex_unlock(&capture_lock);
+
+    path = malloc(strlen(name) + 12);
+    if(!path)
+        return;
+    if(connection == 1)
+        strcpy(path, name);
+    else
+        sprintf(path, "%s.%d", name, connection);
+    c->capture = fopen(path, "wb");
+    free(path);
+    if(!c->capture)
+        return;
+
+    memcpy(header.magic, XCB_CAPTURE_MAGIC, sizeof(header.magic));
+    header.byte_order = XCB_CAPTURE_BYTE_ORDER;
+    header.pad = 0;
+    if(fwrite(&header, sizeof(header), 1, c->capture) != 1)
+    {
+        fclose(c->capture);
+        c->capture = 0;
+    }
+#endif
+}
+
+void _xcb_capture_destroy(xcb_connection_t *c)
+{
+#if XCB_TRACING
+    if(c->capture)
+        fclose(c->capture);
+    c->capture = 0;
+#endif
+}
+
+#if XCB_TRACING
+/* Records the first len bytes of vector. Writers call this with
+ * out.lock held and readers with iolock held, so the stream is locked
+ * to keep each record whole. */
+void _xcb_capture(xcb_connection_t *c, int direction, uint64_t sequence, const struct iovec *vector, int count, size_t len)
+{
+    static const char zeros[8];
+    xcb_capture_record_t record;
+    memset(&record, 0, sizeof(record));
+    record.timestamp = _xcb_stats_now();
+    record.sequence = sequence;
+    record.length = len;
+    record.direction = direction;
+
+    flockfile(c->capture);
+    fwrite(&record, sizeof(record), 1, c->capture);
+    for(; count && len; --count, ++vector)
+    {
+        size_t cur = vector->iov_len < len ? vector->iov_len : len;
+        fwrite(vector->iov_base, 1, cur, c->capture);
+        len -= cur;
+    }
+    fwrite(zeros, 1, XCB_CAPTURE_PAD(record.length), c->capture);
+    funlockfile(c->capture);
+}
+#endif
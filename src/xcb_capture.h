@@ -0,0 +1,61 @@
+/* Copyright (C) 2001-2008 Bart Massey and Jamey Sharp.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * Except as contained in this notice, the names of the authors or their
+ * institutions shall not be used in advertising or otherwise to promote the
+ * sale, use or other dealings in this Software without prior written
+ * authorization from the authors.
+ */
+
+/* Layout of the capture files written when XCB_CAPTURE_FILE is set. Not
+ * installed; shared by the library and the replay benchmark.
+ *
+ * A file is an xcb_capture_header_t followed by records. Each record is
+ * an xcb_capture_record_t followed by its bytes, padded with zeros to a
+ * multiple of 8, so every header is aligned and the file can be walked
+ * in place once mapped. Numbers are in the byte order of the machine
+ * that wrote the file, which byte_order records. */
+
+#ifndef __XCB_CAPTURE_H
+#define __XCB_CAPTURE_H
+
+#define XCB_CAPTURE_MAGIC "XCBCAP\0\1"
+#define XCB_CAPTURE_BYTE_ORDER 0x01020304
+#define XCB_CAPTURE_PAD(length) (-(length) & 7)
+
+typedef struct xcb_capture_header_t {
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t pad;
+} xcb_capture_header_t;
+
+enum xcb_capture_direction_t {
+    XCB_CAPTURE_WRITE, /* client to server */
+    XCB_CAPTURE_READ   /* server to client */
+};
+
+typedef struct xcb_capture_record_t {
+    uint64_t timestamp; /* CLOCK_MONOTONIC, in nanoseconds */
+    uint64_t sequence;  /* newest request queued (writes) or read (reads) */
+    uint32_t length;
+    uint8_t direction;
+    uint8_t pad[3];
+} xcb_capture_record_t;
+
+#endif
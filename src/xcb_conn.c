@@ -32,9 +32,11 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <time.h>
 
 #include "xcb.h"
 #include "xcbint.h"
+#include "xcb_capture.h"
 #if USE_POLL
 #include <poll.h>
 #elif !defined _WIN32
@@ -44,6 +46,7 @@
 #ifdef _WIN32
 #include "xcb_windefs.h"
 #else
+#include <sys/time.h>
 #include <netinet/in.h>
 #endif /* _WIN32 */
 
@@ -123,9 +126,9 @@ static int write_setup(xcb_connection_t *c, xcb_auth_info_t *auth_info)
     }
     assert(count <= (int) (sizeof(parts) / sizeof(*parts)));
 
-    pthread_mutex_lock(&c->iolock);
+    _xcb_lock_out(c);
     ret = _xcb_out_send(c, parts, count);
-    pthread_mutex_unlock(&c->iolock);
+    pthread_mutex_unlock(&c->out.lock);
     return ret;
 }
 
@@ -174,7 +177,6 @@ static int read_setup(xcb_connection_t *c)
 static int write_vec(xcb_connection_t *c, struct iovec **vector, int *count)
 {
     int n;
-    assert(!c->out.queue_len);
 
 #ifdef _WIN32
     int i = 0;
@@ -211,6 +213,10 @@ static int write_vec(xcb_connection_t *c, struct iovec **vector, int *count)
         _xcb_conn_shutdown(c);
         return 0;
     }
+    ++c->stats.writev_calls;
+    c->stats.bytes_written += n;
+    CAPTURE(c, XCB_CAPTURE_WRITE, c->out.request_writing, *vector, *count, n);
+    TRACE_POINT(c, XCB_TRACE_WRITE, c->out.request_writing, 0, 0, n, 0);
 
     for(; *count; --*count, ++*vector)
     {
@@ -256,6 +262,9 @@ int xcb_connection_has_error(xcb_connection_t *c)
 xcb_connection_t *xcb_connect_to_fd(int fd, xcb_auth_info_t *auth_info)
 {
     xcb_connection_t* c;
+    xcb_connect_timings_t *timings;
+    uint64_t start = _xcb_stats_now(), lap = start;
+    int ok;
 
 #ifndef USE_POLL
     if(fd >= FD_SETSIZE) /* would overflow in FD_SET */
@@ -272,22 +281,33 @@ xcb_connection_t *xcb_connect_to_fd(int fd, xcb_auth_info_t *auth_info)
     }
 
     c->fd = fd;
+    /* _xcb_in_destroy must not close fd 0 if we fail before _xcb_in_init */
+    c->in.event_fd[0] = c->in.event_fd[1] = -1;
+    _xcb_capture_init(c);
+    timings = &c->connect_timings;
 
-    if(!(
-        set_fd_flags(fd) &&
+    ok = set_fd_flags(fd) &&
         pthread_mutex_init(&c->iolock, 0) == 0 &&
         _xcb_in_init(&c->in) &&
         _xcb_out_init(&c->out) &&
-        write_setup(c, auth_info) &&
-        read_setup(c) &&
-        _xcb_ext_init(c) &&
-        _xcb_xid_init(c)
-        ))
+        _xcb_stats_init(c);
+    _xcb_stats_lap(&lap);
+    ok = ok && write_setup(c, auth_info);
+    timings->write_setup_ns = _xcb_stats_lap(&lap);
+    ok = ok && read_setup(c);
+    timings->read_setup_ns = _xcb_stats_lap(&lap);
+    ok = ok && _xcb_ext_init(c);
+    timings->ext_init_ns = _xcb_stats_lap(&lap);
+    ok = ok && _xcb_xid_init(c);
+    timings->xid_init_ns = _xcb_stats_lap(&lap);
+    if(!ok)
     {
         xcb_disconnect(c);
         return (xcb_connection_t *) &error_connection;
     }
+    _xcb_trace_init(c);
 
+    timings->total_ns = _xcb_stats_now() - start;
     return c;
 }
 
@@ -300,18 +320,86 @@ void xcb_disconnect(xcb_connection_t *c)
 
     /* disallow further sends and receives */
     shutdown(c->fd, SHUT_RDWR);
+    if(c->in.has_reader_thread)
+        pthread_join(c->in.reader_thread, 0);
     close(c->fd);
 
     pthread_mutex_destroy(&c->iolock);
     _xcb_in_destroy(&c->in);
     _xcb_out_destroy(&c->out);
+    _xcb_stats_destroy(c);
 
     _xcb_ext_destroy(c);
     _xcb_xid_destroy(c);
+    _xcb_trace_destroy(c);
+    _xcb_capture_destroy(c);
 
     free(c);
 }
 
+static void *reader_thread(void *arg)
+{
+    xcb_connection_t *c = arg;
+    int ret = 1;
+#if USE_POLL
+    struct pollfd fd;
+#else
+    fd_set rfds;
+#endif
+
+    _xcb_lock_io(c);
+    while(ret && !c->has_error)
+    {
+        pthread_mutex_unlock(&c->iolock);
+        do {
+#if USE_POLL
+            memset(&fd, 0, sizeof(fd));
+            fd.fd = c->fd;
+            fd.events = POLLIN;
+            ret = poll(&fd, 1, -1);
+            if(ret >= 0 && (fd.revents & ~fd.events))
+            {
+                ret = -1;
+                break;
+            }
+#else
+            FD_ZERO(&rfds);
+            FD_SET(c->fd, &rfds);
+            ret = select(c->fd + 1, &rfds, 0, 0, 0);
+#endif
+        } while (ret == -1 && errno == EINTR);
+        _xcb_lock_io(c);
+        ret = ret > 0 && _xcb_in_read(c);
+    }
+
+    /* Hand the connection's failure on to whoever is waiting. */
+    _xcb_conn_shutdown(c);
+    --c->in.reading;
+    pthread_cond_broadcast(&c->out.cond);
+    _xcb_in_wake_up_next_reader(c);
+    pthread_mutex_unlock(&c->iolock);
+    return 0;
+}
+
+int xcb_enable_reader_thread(xcb_connection_t *c)
+{
+    int ret = 1;
+    if(c->has_error)
+        return 0;
+    _xcb_lock_io(c);
+    if(!c->in.has_reader_thread)
+    {
+        ret = pthread_create(&c->in.reader_thread, 0, reader_thread, c) == 0;
+        if(ret)
+        {
+            c->in.has_reader_thread = 1;
+            ++c->in.reading;
+        }
+    }
+    pthread_mutex_unlock(&c->iolock);
+    return ret;
+}
+
 /* Private interface */
 
 void _xcb_conn_shutdown(xcb_connection_t *c)
@@ -319,8 +407,69 @@ void _xcb_conn_shutdown(xcb_connection_t *c)
     c->has_error = 1;
 }
 
-int _xcb_conn_wait(xcb_connection_t *c, pthread_cond_t *cond, struct iovec **vector, int *count)
+/* Deadlines are taken from the clock the condition variables wait on, a
+ * monotonic one where it can be chosen so that setting the time of day
+ * neither stretches nor cuts short a timeout. */
+#if HAVE_PTHREAD_CONDATTR_SETCLOCK
+#define DEADLINE_CLOCK CLOCK_MONOTONIC
+#else
+#define DEADLINE_CLOCK CLOCK_REALTIME
+#endif
+
+int _xcb_conn_cond_init(pthread_cond_t *cond)
 {
+#if HAVE_PTHREAD_CONDATTR_SETCLOCK
+    pthread_condattr_t attr;
+    int ret;
+    if((ret = pthread_condattr_init(&attr)))
+        return ret;
+    ret = pthread_condattr_setclock(&attr, DEADLINE_CLOCK);
+    if(!ret)
+        ret = pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+    return ret;
+#else
+    return pthread_cond_init(cond, 0);
+#endif
+}
+
+void _xcb_conn_deadline(struct timespec *deadline, int timeout)
+{
+    struct timespec now;
+    if(timeout < 0)
+        return;
+    clock_gettime(DEADLINE_CLOCK, &now);
+    deadline->tv_sec = now.tv_sec + timeout / 1000;
+    deadline->tv_nsec = now.tv_nsec + (timeout % 1000) * 1000000;
+    if(deadline->tv_nsec >= 1000000000)
+    {
+        ++deadline->tv_sec;
+        deadline->tv_nsec -= 1000000000;
+    }
+}
+
+/* Milliseconds left until the deadline, rounded up; -1 for no deadline. */
+static int remaining(const struct timespec *deadline)
+{
+    struct timespec now;
+    int64_t ns;
+    if(!deadline)
+        return -1;
+    clock_gettime(DEADLINE_CLOCK, &now);
+    ns = (int64_t) (deadline->tv_sec - now.tv_sec) * 1000000000 + (deadline->tv_nsec - now.tv_nsec);
+    return ns > 0 ? (ns + 999999) / 1000000 : 0;
+}
+
+int _xcb_conn_expired(const struct timespec *deadline)
+{
+    return deadline && remaining(deadline) == 0;
+}
+
+int _xcb_conn_wait(xcb_connection_t *c, pthread_cond_t *cond, struct iovec **vector, int *count, const struct timespec *deadline)
+{
+    /* Writers come here holding out.lock, readers holding iolock. */
+    pthread_mutex_t *lock = count ? &c->out.lock : &c->iolock;
+    int reading = !count;
     int ret;
 #if USE_POLL
     struct pollfd fd;
@@ -328,42 +477,56 @@ int _xcb_conn_wait(xcb_connection_t *c, pthread_cond_t *cond, struct iovec **vec
     fd_set rfds, wfds;
 #endif
 
+    if(c->has_error)
+        return 0;
+
     /* If the thing I should be doing is already being done, wait for it. */
     if(count ? c->out.writing : c->in.reading)
     {
-        pthread_cond_wait(cond, &c->iolock);
-        return 1;
+        TRACE_POINT(c, XCB_TRACE_BLOCK, count ? c->out.request : c->in.request_read, 0, 0, 0, 0);
+        if(deadline)
+            pthread_cond_timedwait(cond, lock, deadline);
+        else
+            pthread_cond_wait(cond, lock);
+        TRACE_POINT(c, XCB_TRACE_RESUME, count ? c->out.request : c->in.request_read, 0, 0, 0, 0);
+        return !c->has_error;
+    }
+
+    /* A writer must keep reading while it waits, or it could deadlock
+     * against a server that is blocked writing to us; but if some other
+     * thread is already reading, leave it to that one, unless that thread
+     * is gone by the time there is something to read. */
+    if(count)
+    {
+        ++c->out.writing;
+        _xcb_lock_io(c);
+        reading = !c->in.reading;
+        if(reading)
+            ++c->in.reading;
+        pthread_mutex_unlock(&c->iolock);
     }
+    else
+        ++c->in.reading;
 
 #if USE_POLL
     memset(&fd, 0, sizeof(fd));
     fd.fd = c->fd;
     fd.events = POLLIN;
-#else
-    FD_ZERO(&rfds);
-    FD_SET(c->fd, &rfds);
-#endif
-    ++c->in.reading;
-
-#if USE_POLL
     if(count)
-    {
         fd.events |= POLLOUT;
-        ++c->out.writing;
-    }
 #else
+    FD_ZERO(&rfds);
+    FD_SET(c->fd, &rfds);
     FD_ZERO(&wfds);
     if(count)
-    {
         FD_SET(c->fd, &wfds);
-        ++c->out.writing;
-    }
 #endif
 
-    pthread_mutex_unlock(&c->iolock);
+    TRACE_POINT(c, XCB_TRACE_BLOCK, count ? c->out.request : c->in.request_read, 0, 0, 0, 0);
+    pthread_mutex_unlock(lock);
     do {
 #if USE_POLL
-        ret = poll(&fd, 1, -1);
+        ret = poll(&fd, 1, remaining(deadline));
         /* If poll() returns an event we didn't expect, such as POLLNVAL, treat
          * it as if it failed. */
         if(ret >= 0 && (fd.revents & ~fd.events))
@@ -372,7 +535,14 @@ int _xcb_conn_wait(xcb_connection_t *c, pthread_cond_t *cond, struct iovec **vec
             break;
         }
 #else
-        ret = select(c->fd + 1, &rfds, &wfds, 0, 0);
+        struct timeval timeout;
+        if(deadline)
+        {
+            int ms = remaining(deadline);
+            timeout.tv_sec = ms / 1000;
+            timeout.tv_usec = (ms % 1000) * 1000;
+        }
+        ret = select(c->fd + 1, &rfds, &wfds, 0, deadline ? &timeout : 0);
 #endif
     } while (ret == -1 && errno == EINTR);
     if(ret < 0)
@@ -380,28 +550,50 @@ int _xcb_conn_wait(xcb_connection_t *c, pthread_cond_t *cond, struct iovec **vec
         _xcb_conn_shutdown(c);
         ret = 0;
     }
-    pthread_mutex_lock(&c->iolock);
+    else if(ret == 0)
+        ret = 1; /* timed out; nothing to read or write */
 
-    if(ret)
+    if(reading)
     {
+        _xcb_lock_io(c);
 #if USE_POLL
-        if((fd.revents & POLLIN) == POLLIN)
+        if(ret && (fd.revents & POLLIN) == POLLIN)
 #else
-        if(FD_ISSET(c->fd, &rfds))
+        if(ret && FD_ISSET(c->fd, &rfds))
 #endif
-            ret = ret && _xcb_in_read(c);
-
+            ret = _xcb_in_read(c);
+        --c->in.reading;
+        /* a writer that was reading hands the job on to a waiting reader */
+        if(count)
+        {
+            _xcb_in_wake_up_next_reader(c);
+            pthread_mutex_unlock(&c->iolock);
+        }
+    }
 #if USE_POLL
-        if((fd.revents & POLLOUT) == POLLOUT)
+    else if(ret && (fd.revents & POLLIN) == POLLIN)
 #else
-        if(FD_ISSET(c->fd, &wfds))
+    else if(ret && FD_ISSET(c->fd, &rfds))
 #endif
-            ret = ret && write_vec(c, vector, count);
+    {
+        _xcb_lock_io(c);
+        if(!c->in.reading)
+            ret = _xcb_in_read(c);
+        pthread_mutex_unlock(&c->iolock);
     }
 
     if(count)
+    {
+        _xcb_lock_out(c);
+#if USE_POLL
+        if(ret && (fd.revents & POLLOUT) == POLLOUT)
+#else
+        if(ret && FD_ISSET(c->fd, &wfds))
+#endif
+            ret = write_vec(c, vector, count);
         --c->out.writing;
-    --c->in.reading;
+    }
 
+    TRACE_POINT(c, XCB_TRACE_RESUME, count ? c->out.request : c->in.request_read, 0, 0, 0, 0);
     return ret;
 }
@@ -108,6 +108,26 @@ void xcb_prefetch_extension_data(xcb_connection_t *c, xcb_extension_t *ext)
     pthread_mutex_unlock(&c->ext.lock);
 }
 
+int xcb_set_extension_event_handler(xcb_connection_t *c, xcb_extension_t *ext, uint8_t event, xcb_event_handler_t handler, void *data)
+{
+    const xcb_query_extension_reply_t *reply = xcb_get_extension_data(c, ext);
+    if(!reply || !reply->present || reply->first_event + event > 0x7f)
+        return 0;
+    return xcb_set_event_handler(c, reply->first_event + event, handler, data);
+}
+
+int xcb_set_ge_event_handler(xcb_connection_t *c, xcb_extension_t *ext, uint16_t event_type, xcb_event_handler_t handler, void *data)
+{
+    int ret;
+    const xcb_query_extension_reply_t *reply = xcb_get_extension_data(c, ext);
+    if(!reply || !reply->present)
+        return 0;
+    _xcb_lock_io(c);
+    ret = _xcb_in_set_ge_event_handler(c, reply->major_opcode, event_type, handler, data);
+    pthread_mutex_unlock(&c->iolock);
+    return ret;
+}
+
 /* Private interface */
 
 int _xcb_ext_init(xcb_connection_t *c)
@@ -122,6 +142,6 @@ void _xcb_ext_destroy(xcb_connection_t *c)
     pthread_mutex_destroy(&c->ext.lock);
     while(c->ext.extensions_size-- > 0)
         if(c->ext.extensions[c->ext.extensions_size].tag == LAZY_FORCED)
-            free(c->ext.extensions[c->ext.extensions_size].value.reply);
+            _xcb_in_free_reply(c, c->ext.extensions[c->ext.extensions_size].value.reply);
     free(c->ext.extensions);
 }
@@ -35,12 +35,17 @@
 #include "xcb.h"
 #include "xcbext.h"
 #include "xcbint.h"
+#include "xcb_capture.h"
 #if USE_POLL
 #include <poll.h>
 #endif
 #ifndef _WIN32
 #include <sys/select.h>
 #include <sys/socket.h>
+#include <fcntl.h>
+#endif
+#if HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
 #endif
 
 #ifdef _WIN32
@@ -51,6 +56,13 @@
 #define XCB_REPLY 1
 #define XCB_XGE_EVENT 35
 
+/* Events and errors are 32 bytes on the wire, plus the full_sequence field
+ * XCB appends. */
+#define XCB_EVENT_BUFFER_SIZE (32 + sizeof(uint32_t))
+
+/* How many released objects of each kind a connection keeps for reuse. */
+#define XCB_FREELIST_MAX 1024
+
 /* required for compiling for Win32 using MinGW */
 #ifndef MSG_WAITALL
 #define MSG_WAITALL 0
@@ -61,11 +73,34 @@ struct event_list {
     struct event_list *next;
 };
 
+/* The event ring has a single producer, read_packet under iolock, and any
+ * number of consumers that claim the head with compare-and-swap. Without
+ * atomic builtins everybody takes iolock and these are plain operations. */
+#if HAVE_SYNC_BUILTINS
+#define CAS(p, old, new) __sync_bool_compare_and_swap(p, old, new)
+#define BARRIER() __sync_synchronize()
+#else
+#define CAS(p, old, new) (*(p) == (old) ? (*(p) = (new), 1) : 0)
+#define BARRIER()
+#endif
+
+/* A slot is empty (null), holds an event, or holds one of these. */
+static char ring_busy, ring_hole;
+#define RING_BUSY ((xcb_generic_event_t *) &ring_busy) /* reader is coalescing into it */
+#define RING_HOLE ((xcb_generic_event_t *) &ring_hole) /* event superseded by a newer one */
+#define RING_SLOT(in, pos) ((in)->ring + ((pos) & (XCB_EVENT_RING_SIZE - 1)))
+
 struct reply_list {
     void *reply;
     struct reply_list *next;
+    _xcb_in *in; /* null if reply is a buffer from xcb_set_reply_buffer */
 };
 
+typedef struct reply_buffer {
+    void *buffer;
+    size_t size;
+} reply_buffer;
+
 typedef struct pending_reply {
     uint64_t first_request;
     uint64_t last_request;
@@ -74,27 +109,505 @@ typedef struct pending_reply {
     struct pending_reply *next;
 } pending_reply;
 
+/* Coalescing policy for one event type. queued maps each key to the
+ * event_list node holding the newest queued event with that key. */
+typedef struct event_coalescing {
+    xcb_event_coalescing_t policy;
+    unsigned int key_offset;
+    xcb_event_merge_func_t merge;
+    void *data;
+    _xcb_map *queued;
+} event_coalescing;
+
+#define XCB_COALESCING_TYPES 128
+
+static void *alloc_buffer(_xcb_in *in, size_t size)
+{
+    if(in->alloc)
+        return in->alloc(size, in->alloc_data);
+    return malloc(size);
+}
+
+static void free_buffer(_xcb_in *in, void *buf)
+{
+    if(!buf)
+        return;
+    if(in->alloc)
+        in->release(buf, in->alloc_data);
+    else
+        free(buf);
+}
+
+/* Fixed-size event buffers are recycled, unless the application
+ * provides its own allocator. */
+static void *get_event_buffer(_xcb_in *in)
+{
+    if(in->alloc)
+        return alloc_buffer(in, XCB_EVENT_BUFFER_SIZE);
+    return _xcb_freelist_get(&in->event_buffers);
+}
+
+static void put_event_buffer(_xcb_in *in, void *buf)
+{
+    if(in->alloc)
+        free_buffer(in, buf);
+    else
+        _xcb_freelist_put(&in->event_buffers, buf);
+}
+
+/* Whether read_packet took an event's buffer from get_event_buffer: all
+ * but GenericEvents with data after the first 32 bytes. A SendEvent
+ * GenericEvent is never read as one, so it counts as a plain event. */
+static int is_event_buffer(const xcb_generic_event_t *event)
+{
+    return event->response_type != XCB_XGE_EVENT ||
+           !((const xcb_ge_event_t *) event)->length;
+}
+
+static void free_reply(struct reply_list *cur)
+{
+    if(cur->in)
+        free_buffer(cur->in, cur->reply);
+}
+
+/* Returns the caller's buffer for the reply to request, if one was set and
+ * is big enough. */
+static void *take_reply_buffer(xcb_connection_t *c, uint64_t request, int length)
+{
+    reply_buffer *dest;
+    void *ret = 0;
+    if(!c->in.reply_buffers)
+        return 0;
+    dest = _xcb_map_remove(c->in.reply_buffers, request);
+    if(dest && dest->size >= (size_t) length)
+        ret = dest->buffer;
+    free(dest);
+    return ret;
+}
+
+/* The event fd is readable exactly while events are queued. */
+static void signal_event_fd(_xcb_in *in)
+{
+#ifndef _WIN32
+    if(in->event_fd[1] < 0 || in->event_fd_ready)
+        return;
+    {
+#if HAVE_SYS_EVENTFD_H
+        uint64_t one = 1;
+#else
+        char one = 1;
+#endif
+        if(write(in->event_fd[1], &one, sizeof(one)) == sizeof(one))
+            in->event_fd_ready = 1;
+    }
+#endif
+}
+
+static void drain_event_fd(_xcb_in *in)
+{
+#ifndef _WIN32
+    if(!in->event_fd_ready)
+        return;
+    {
+#if HAVE_SYS_EVENTFD_H
+        uint64_t count;
+#else
+        char count;
+#endif
+        if(read(in->event_fd[0], &count, sizeof(count)) == sizeof(count))
+            in->event_fd_ready = 0;
+    }
+#endif
+}
+
+static uint32_t coalescing_key(const event_coalescing *coalescing, const xcb_generic_event_t *event)
+{
+    uint32_t key;
+    memcpy(&key, (const char *) event + coalescing->key_offset, sizeof(key));
+    return key;
+}
+
+static event_coalescing *get_coalescing(xcb_connection_t *c, const xcb_generic_event_t *event)
+{
+    event_coalescing *coalescing;
+    /* synthetic events, from SendEvent, are always delivered as sent */
+    if(!c->in.coalescing || event->response_type >= XCB_COALESCING_TYPES)
+        return 0;
+    coalescing = c->in.coalescing + event->response_type;
+    return coalescing->queued ? coalescing : 0;
+}
+
+/* Returns 1 if the event was folded into, or superseded by, a queued
+ * one. Otherwise the caller queues it and calls track_event.
+ *
+ * Only events in the ring are tracked, by ring position. Consumers do not
+ * untrack what they take, so a position is checked before use; the slot is
+ * then locked against consumers while the older event is changed. */
+static int coalesce_event(xcb_connection_t *c, xcb_generic_event_t *event)
+{
+    event_coalescing *coalescing = get_coalescing(c, event);
+    uint32_t key;
+    uintptr_t pos;
+    unsigned int head = c->in.ring_head;
+    xcb_generic_event_t *volatile *slot;
+    xcb_generic_event_t *older;
+    int ret = 0;
+    if(!coalescing)
+        return 0;
+    key = coalescing_key(coalescing, event);
+    pos = (uintptr_t) _xcb_map_get(coalescing->queued, key);
+    if(!pos--)
+        return 0;
+    slot = RING_SLOT(&c->in, pos);
+    older = *slot;
+    if((unsigned int) pos - head >= c->in.ring_tail - head ||
+       !older || older == RING_HOLE || !CAS(slot, older, RING_BUSY))
+    {
+        /* already taken */
+        _xcb_map_remove(coalescing->queued, key);
+        return 0;
+    }
+    if(coalescing->policy == XCB_COALESCE_MERGE)
+    {
+        ret = coalescing->merge(older, event, coalescing->data);
+        if(ret)
+            put_event_buffer(&c->in, event);
+    }
+    else
+    {
+        /* XCB_COALESCE_REPLACE: leave a hole where the older event was */
+        put_event_buffer(&c->in, older);
+        older = RING_HOLE;
+    }
+    BARRIER();
+    *slot = older;
+    return ret;
+}
+
+static void track_event(xcb_connection_t *c, xcb_generic_event_t *event, unsigned int pos)
+{
+    event_coalescing *coalescing = get_coalescing(c, event);
+    if(coalescing && !_xcb_map_put(coalescing->queued, coalescing_key(coalescing, event), (void *) ((uintptr_t) pos + 1)))
+        _xcb_conn_shutdown(c);
+}
+
+/* Appends to the ring if there is room. Called with iolock held. */
+static int ring_put(_xcb_in *in, xcb_generic_event_t *event)
+{
+    unsigned int tail = in->ring_tail;
+    xcb_generic_event_t *volatile *slot = RING_SLOT(in, tail);
+    /* a consumer may have claimed the previous occupant but not yet
+     * taken it out */
+    if(tail - in->ring_head >= XCB_EVENT_RING_SIZE || *slot)
+        return 0;
+    *slot = event;
+    BARRIER();
+    in->ring_tail = tail + 1;
+    return 1;
+}
+
+/* Takes the oldest event in the ring. Safe without iolock when the atomic
+ * builtins are available. */
+static xcb_generic_event_t *ring_take(_xcb_in *in)
+{
+    for(;;)
+    {
+        unsigned int head = in->ring_head;
+        xcb_generic_event_t *volatile *slot;
+        xcb_generic_event_t *event;
+        BARRIER();
+        if(head == in->ring_tail)
+            return 0;
+        if(!CAS(&in->ring_head, head, head + 1))
+            continue;
+        slot = RING_SLOT(in, head);
+        do
+            event = *slot;
+        while(event == RING_BUSY || !CAS(slot, event, 0));
+        if(event && event != RING_HOLE)
+            return event;
+    }
+}
+
+/* Moves overflowed events into the ring as it drains. Called with iolock
+ * held. */
+static void refill_ring(xcb_connection_t *c)
+{
+    while(c->in.events)
+    {
+        struct event_list *cur = c->in.events;
+        unsigned int pos = c->in.ring_tail;
+        if(!ring_put(&c->in, cur->event))
+            break;
+        c->in.events = cur->next;
+        if(!cur->next)
+            c->in.events_tail = &c->in.events;
+        --c->in.events_len;
+        if((cur->event->response_type & 0x7f) != XCB_XGE_EVENT)
+            track_event(c, cur->event, pos);
+        _xcb_freelist_put(&c->in.nodes, cur);
+    }
+}
+
+static int have_events(xcb_connection_t *c)
+{
+    return c->in.ring_head != c->in.ring_tail || c->in.events;
+}
+
+/* Handlers for events delivered straight from read_packet. Core and
+ * extension events are looked up by response type in a table; XGE events
+ * by extension opcode and event type in a map. */
+typedef struct event_handler {
+    xcb_event_handler_t handler;
+    void *data;
+} event_handler;
+
+#define XCB_HANDLER_TYPES 128
+#define GE_HANDLER_KEY(extension,event_type) (((unsigned int) (extension) << 16) | (event_type))
+
+static int dispatch_event(xcb_connection_t *c, const xcb_generic_event_t *event)
+{
+    event_handler *handler = 0;
+    if(!c->in.handlers)
+        return 0;
+    if(event->response_type == XCB_XGE_EVENT)
+    {
+        const xcb_ge_event_t *ge = (const xcb_ge_event_t *) event;
+        if(c->in.ge_handlers)
+            handler = _xcb_map_get(c->in.ge_handlers, GE_HANDLER_KEY(ge->pad0, ge->event_type));
+    }
+    else
+        handler = c->in.handlers + (event->response_type & 0x7f);
+    return handler && handler->handler && handler->handler(event, handler->data);
+}
+
+/* Threads waiting for replies are kept in a binary min-heap ordered by
+ * sequence number, in c->in.readers. index is the reader's position in the
+ * heap, or -1 once it has been woken and removed. */
 typedef struct reader_list {
-    unsigned int request;
+    uint64_t request;
     pthread_cond_t *data;
-    struct reader_list *next;
+    int index;
 } reader_list;
 
+static void reader_set(_xcb_in *in, int i, reader_list *reader)
+{
+    in->readers[i] = reader;
+    reader->index = i;
+}
+
+static void reader_sift(_xcb_in *in, int i)
+{
+    reader_list *reader = in->readers[i];
+    while(i > 0 && XCB_SEQUENCE_COMPARE(reader->request, <, in->readers[(i - 1) / 2]->request))
+    {
+        reader_set(in, i, in->readers[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    for(;;)
+    {
+        int child = 2 * i + 1;
+        if(child >= in->readers_len)
+            break;
+        if(child + 1 < in->readers_len &&
+           XCB_SEQUENCE_COMPARE(in->readers[child + 1]->request, <, in->readers[child]->request))
+            ++child;
+        if(!XCB_SEQUENCE_COMPARE(in->readers[child]->request, <, reader->request))
+            break;
+        reader_set(in, i, in->readers[child]);
+        i = child;
+    }
+    reader_set(in, i, reader);
+}
+
+static int insert_reader(xcb_connection_t *c, reader_list *reader)
+{
+    if(c->in.readers_len == c->in.readers_size)
+    {
+        int new_size = c->in.readers_size ? c->in.readers_size * 2 : 8;
+        reader_list **new_readers = realloc(c->in.readers, new_size * sizeof(reader_list *));
+        if(!new_readers)
+        {
+            _xcb_conn_shutdown(c);
+            return 0;
+        }
+        c->in.readers = new_readers;
+        c->in.readers_size = new_size;
+    }
+    reader_set(&c->in, c->in.readers_len++, reader);
+    reader_sift(&c->in, reader->index);
+    return 1;
+}
+
+static void remove_reader(xcb_connection_t *c, reader_list *reader)
+{
+    int i = reader->index;
+    reader->index = -1;
+    if(--c->in.readers_len == i)
+        return;
+    reader_set(&c->in, i, c->in.readers[c->in.readers_len]);
+    reader_sift(&c->in, i);
+}
+
+/* Wake every reader whose request is at or before the given sequence
+ * number. Woken readers leave the heap, and put themselves back if they
+ * find they have to keep waiting. */
+static void wake_up_readers(xcb_connection_t *c, uint64_t request)
+{
+    while(c->in.readers_len &&
+          XCB_SEQUENCE_COMPARE(c->in.readers[0]->request, <=, request))
+    {
+        pthread_cond_signal(c->in.readers[0]->data);
+        remove_reader(c, c->in.readers[0]);
+    }
+}
+
+/* The pending_reply for the packet being read, if any: either the head of
+ * the pending_replies queue, or a discard record created by
+ * xcb_discard_reply for a request that had no pending_reply of its own. */
+static pending_reply *current_pending(xcb_connection_t *c)
+{
+    pending_reply *pend = c->in.pending_replies;
+    if(pend &&
+       XCB_SEQUENCE_COMPARE(pend->first_request, <=, c->in.request_read) &&
+       (pend->workaround == WORKAROUND_EXTERNAL_SOCKET_OWNER ||
+        XCB_SEQUENCE_COMPARE(c->in.request_read, <=, pend->last_request)))
+        return pend;
+    if(c->in.discards_len)
+        return _xcb_map_get(c->in.discards, c->in.request_read);
+    return 0;
+}
+
+/* Forget discard records for requests before the one being read: all of
+ * their responses have arrived. Each request number is visited once. */
+static void expire_discards(xcb_connection_t *c, uint64_t from)
+{
+    for(; c->in.discards_len && XCB_SEQUENCE_COMPARE(from, <, c->in.request_read); ++from)
+    {
+        pending_reply *pend = _xcb_map_remove(c->in.discards, from);
+        if(pend)
+        {
+            --c->in.discards_len;
+            _xcb_freelist_put(&c->in.pending, pend);
+        }
+    }
+}
+
+/* The input queue is a ring: queue_len bytes starting at queue_head,
+ * wrapping around at the end of the buffer. */
+
+static void queue_peek(const _xcb_in *in, void *buf, int len)
+{
+    int first = sizeof(in->queue) - in->queue_head;
+    if(first > len)
+        first = len;
+    memcpy(buf, in->queue + in->queue_head, first);
+    memcpy((char *) buf + first, in->queue, len - first);
+}
+
+static void queue_skip(_xcb_in *in, int len)
+{
+    in->queue_len -= len;
+    in->queue_head += len;
+    if(in->queue_head >= (int) sizeof(in->queue))
+        in->queue_head -= sizeof(in->queue);
+    /* keep free space contiguous whenever possible */
+    if(!in->queue_len)
+        in->queue_head = 0;
+}
+
+#if XCB_TRACING
+static xcb_trace_point_t trace_point(uint8_t response_type)
+{
+    if(response_type == XCB_REPLY)
+        return XCB_TRACE_REPLY;
+    if(response_type == XCB_ERROR)
+        return XCB_TRACE_ERROR;
+    return XCB_TRACE_EVENT;
+}
+
+static uint8_t trace_major_opcode(const xcb_generic_event_t *packet)
+{
+    if(packet->response_type == XCB_REPLY)
+        return 0;
+    if(packet->response_type == XCB_ERROR)
+        return ((const xcb_generic_error_t *) packet)->major_code;
+    return packet->response_type;
+}
+
+static uint16_t trace_minor_opcode(const xcb_generic_event_t *packet)
+{
+    if(packet->response_type == XCB_ERROR)
+        return ((const xcb_generic_error_t *) packet)->minor_code;
+    if(packet->response_type == XCB_XGE_EVENT)
+        return ((const xcb_ge_event_t *) packet)->event_type;
+    return 0;
+}
+#endif
+
+/* Queues an event or unchecked error read into buf, coalescing it with a
+ * queued one if its type asks for that. Returns 0 if it could not. */
+static int queue_event(xcb_connection_t *c, xcb_generic_event_t *buf, int eventlength)
+{
+    struct event_list *event;
+    unsigned int pos, depth;
+    if(!eventlength && coalesce_event(c, buf))
+        return 1;
+    if(c->in.events)
+        refill_ring(c);
+    pos = c->in.ring_tail;
+    /* keep events in order: once some overflowed, queue after them */
+    if(!c->in.events && ring_put(&c->in, buf))
+    {
+        if(!eventlength)
+            track_event(c, buf, pos);
+    }
+    else
+    {
+        event = _xcb_freelist_get(&c->in.nodes);
+        if(!event)
+        {
+            _xcb_conn_shutdown(c);
+            free_buffer(&c->in, buf);
+            return 0;
+        }
+        event->event = buf;
+        event->next = 0;
+        *c->in.events_tail = event;
+        c->in.events_tail = &event->next;
+        ++c->in.events_len;
+    }
+    ++c->stats.events_queued;
+    depth = c->in.ring_tail - c->in.ring_head + c->in.events_len;
+    if(depth > c->stats.event_queue_peak)
+        c->stats.event_queue_peak = depth;
+    signal_event_fd(&c->in);
+    pthread_cond_signal(&c->in.event_cond);
+    return 1; /* I have something for you... */
+}
+
 static int read_packet(xcb_connection_t *c)
 {
+    union {
+        xcb_generic_reply_t genrep;
+        xcb_generic_event_t event;
+        uint32_t words[8];
+    } packet;
     xcb_generic_reply_t genrep;
     int length = 32;
     int eventlength = 0; /* length after first 32 bytes for GenericEvents */
     void *buf;
+    int external = 0; /* buf is the caller's, from xcb_set_reply_buffer */
     pending_reply *pend = 0;
-    struct event_list *event;
 
     /* Wait for there to be enough data for us to read a whole packet */
     if(c->in.queue_len < length)
         return 0;
 
-    /* Get the response type, length, and sequence number. */
-    memcpy(&genrep, c->in.queue, sizeof(genrep));
+    /* Get the response type, length, and sequence number. Every packet
+     * starts with 32 bytes, which for most events is the whole thing. */
+    queue_peek(&c->in, &packet, sizeof(packet.words));
+    genrep = packet.genrep;
 
     /* Compute 32-bit sequence number of this packet. */
     if((genrep.response_type & 0x7f) != XCB_KEYMAP_NOTIFY)
@@ -103,14 +616,24 @@ static int read_packet(xcb_connection_t *c)
         c->in.request_read = (lastread & UINT64_C(0xffffffffffff0000)) | genrep.sequence;
         if(XCB_SEQUENCE_COMPARE(c->in.request_read, <, lastread))
             c->in.request_read += 0x10000;
+        pthread_mutex_lock(&c->in.expected_lock);
         if(XCB_SEQUENCE_COMPARE(c->in.request_read, >, c->in.request_expected))
             c->in.request_expected = c->in.request_read;
+        pthread_mutex_unlock(&c->in.expected_lock);
 
         if(c->in.request_read != lastread)
         {
+            expire_discards(c, lastread);
+            /* a reply buffer nobody used is of no further interest */
+            if(c->in.reply_buffers)
+                free(_xcb_map_remove(c->in.reply_buffers, lastread));
             if(c->in.current_reply)
             {
-                _xcb_map_put(c->in.replies, lastread, c->in.current_reply);
+                if(!_xcb_map_put(c->in.replies, lastread, c->in.current_reply))
+                {
+                    _xcb_conn_shutdown(c);
+                    return 0;
+                }
                 c->in.current_reply = 0;
                 c->in.current_reply_tail = &c->in.current_reply;
             }
@@ -125,31 +648,26 @@ static int read_packet(xcb_connection_t *c)
             c->in.pending_replies = oldpend->next;
             if(!oldpend->next)
                 c->in.pending_replies_tail = &c->in.pending_replies;
-            free(oldpend);
+            if(_xcb_map_get(c->in.pending_index, oldpend->first_request) == oldpend)
+                _xcb_map_remove(c->in.pending_index, oldpend->first_request);
+            _xcb_freelist_put(&c->in.pending, oldpend);
         }
 
         if(genrep.response_type == XCB_ERROR)
             c->in.request_completed = c->in.request_read;
+
+        /* readers of completed requests can't get any more replies */
+        wake_up_readers(c, c->in.request_completed);
     }
 
     if(genrep.response_type == XCB_ERROR || genrep.response_type == XCB_REPLY)
-    {
-        pend = c->in.pending_replies;
-        if(pend &&
-           !(XCB_SEQUENCE_COMPARE(pend->first_request, <=, c->in.request_read) &&
-             (pend->workaround == WORKAROUND_EXTERNAL_SOCKET_OWNER ||
-              XCB_SEQUENCE_COMPARE(c->in.request_read, <=, pend->last_request))))
-            pend = 0;
-    }
+        pend = current_pending(c);
 
     /* For reply packets, check that the entire packet is available. */
     if(genrep.response_type == XCB_REPLY)
     {
         if(pend && pend->workaround == WORKAROUND_GLX_GET_FB_CONFIGS_BUG)
-        {
-            uint32_t *p = (uint32_t *) c->in.queue;
-            genrep.length = p[2] * p[3] * 2;
-        }
+            genrep.length = packet.words[2] * packet.words[3] * 2;
         length += genrep.length * 4;
     }
 
@@ -157,17 +675,46 @@ static int read_packet(xcb_connection_t *c)
     if (genrep.response_type == XCB_XGE_EVENT)
         eventlength = genrep.length * 4;
 
-    buf = malloc(length + eventlength +
-            (genrep.response_type == XCB_REPLY ? 0 : sizeof(uint32_t)));
+    if(c->latency.enabled && (genrep.response_type == XCB_REPLY || genrep.response_type == XCB_ERROR))
+        _xcb_stats_reply_read(c, c->in.request_read, length);
+    TRACE_POINT(c, trace_point(genrep.response_type), c->in.request_read,
+                trace_major_opcode(&packet.event), trace_minor_opcode(&packet.event),
+                length + eventlength, &packet);
+
+    /* Hand plain events with a registered handler over straight from the
+     * packet header, without allocating anything. */
+    if(c->in.handlers && genrep.response_type != XCB_REPLY &&
+       genrep.response_type != XCB_ERROR && !eventlength)
+    {
+        packet.event.full_sequence = c->in.request_read;
+        if(dispatch_event(c, &packet.event))
+        {
+            queue_skip(&c->in, sizeof(packet.words));
+            return 1;
+        }
+    }
+
+    if(genrep.response_type != XCB_REPLY && !eventlength)
+        buf = get_event_buffer(&c->in);
+    else if(genrep.response_type == XCB_REPLY && !(pend && (pend->flags & XCB_REQUEST_DISCARD_REPLY)) &&
+            (buf = take_reply_buffer(c, c->in.request_read, length)))
+        external = 1;
+    else
+        buf = alloc_buffer(&c->in, length + eventlength +
+                (genrep.response_type == XCB_REPLY ? 0 : sizeof(uint32_t)));
     if(!buf)
     {
         _xcb_conn_shutdown(c);
         return 0;
     }
 
-    if(_xcb_in_read_block(c, buf, length) <= 0)
+    memcpy(buf, &packet, sizeof(packet.words));
+    queue_skip(&c->in, sizeof(packet.words));
+    if(length > (int) sizeof(packet.words) &&
+       _xcb_in_read_block(c, (char *) buf + sizeof(packet.words), length - sizeof(packet.words)) <= 0)
     {
-        free(buf);
+        if(!external)
+            free_buffer(&c->in, buf);
         return 0;
     }
 
@@ -176,14 +723,17 @@ static int read_packet(xcb_connection_t *c)
     {
         if(_xcb_in_read_block(c, &((xcb_generic_event_t*)buf)[1], eventlength) <= 0)
         {
-            free(buf);
+            free_buffer(&c->in, buf);
             return 0;
         }
     }
 
     if(pend && (pend->flags & XCB_REQUEST_DISCARD_REPLY))
     {
-        free(buf);
+        if(genrep.response_type == XCB_ERROR)
+            put_event_buffer(&c->in, buf);
+        else
+            free_buffer(&c->in, buf);
         return 1;
     }
 
@@ -194,60 +744,162 @@ static int read_packet(xcb_connection_t *c)
     if( genrep.response_type == XCB_REPLY ||
        (genrep.response_type == XCB_ERROR && pend && (pend->flags & XCB_REQUEST_CHECKED)))
     {
-        reader_list *reader;
-        struct reply_list *cur = malloc(sizeof(struct reply_list));
+        struct reply_list *cur = _xcb_freelist_get(&c->in.nodes);
         if(!cur)
         {
             _xcb_conn_shutdown(c);
-            free(buf);
+            if(!external)
+                free_buffer(&c->in, buf);
             return 0;
         }
         cur->reply = buf;
         cur->next = 0;
+        cur->in = external ? 0 : &c->in;
         *c->in.current_reply_tail = cur;
         c->in.current_reply_tail = &cur->next;
-        for(reader = c->in.readers; 
-	    reader && 
-	    XCB_SEQUENCE_COMPARE_32(reader->request, <=, c->in.request_read);
-	    reader = reader->next)
-	{
-            if(XCB_SEQUENCE_COMPARE_32(reader->request, ==, c->in.request_read))
-            {
-                pthread_cond_signal(reader->data);
-                break;
-            }
-	}
+        if(++c->stats.reply_queue_depth > c->stats.reply_queue_peak)
+            c->stats.reply_queue_peak = c->stats.reply_queue_depth;
+        wake_up_readers(c, c->in.request_read);
         return 1;
     }
 
     /* event, or unchecked error */
-    event = malloc(sizeof(struct event_list));
-    if(!event)
+    if((genrep.response_type == XCB_ERROR || eventlength) && dispatch_event(c, buf))
     {
-        _xcb_conn_shutdown(c);
-        free(buf);
-        return 0;
+        if(eventlength)
+            free_buffer(&c->in, buf);
+        else
+            put_event_buffer(&c->in, buf);
+        return 1;
     }
-    event->event = buf;
-    event->next = 0;
-    *c->in.events_tail = event;
-    c->in.events_tail = &event->next;
-    pthread_cond_signal(&c->in.event_cond);
-    return 1; /* I have something for you... */
+    return queue_event(c, buf, eventlength);
 }
 
-static xcb_generic_event_t *get_event(xcb_connection_t *c)
+/* Splits off, in one pass over the ring, the run of plain 32-byte events
+ * that follows the packet read_packet just handled. The run ends at
+ * anything that needs read_packet: a reply, an error, an XGE event, a
+ * packet that wraps around the end of the ring, or a new sequence number,
+ * which brings bookkeeping for the requests before it. Returns 0 if an
+ * event could not be queued. */
+static int read_events(xcb_connection_t *c)
 {
-    struct event_list *cur = c->in.events;
-    xcb_generic_event_t *ret;
+    while(c->in.queue_len >= 32 && c->in.queue_head + 32 <= (int) sizeof(c->in.queue))
+    {
+        const uint8_t *packet = (const uint8_t *) c->in.queue + c->in.queue_head;
+        xcb_generic_event_t *buf;
+        uint16_t sequence;
+
+        if(packet[0] == XCB_REPLY || packet[0] == XCB_ERROR || packet[0] == XCB_XGE_EVENT)
+            break;
+        memcpy(&sequence, packet + 2, sizeof(sequence));
+        if((packet[0] & 0x7f) != XCB_KEYMAP_NOTIFY && sequence != (uint16_t) c->in.request_read)
+            break;
+        TRACE_POINT(c, XCB_TRACE_EVENT, c->in.request_read, packet[0], 0, 32, packet);
+
+        if(c->in.handlers)
+        {
+            xcb_generic_event_t event;
+            memcpy(&event, packet, 32);
+            event.full_sequence = c->in.request_read;
+            if(dispatch_event(c, &event))
+            {
+                queue_skip(&c->in, 32);
+                continue;
+            }
+        }
+
+        buf = get_event_buffer(&c->in);
+        if(!buf)
+        {
+            _xcb_conn_shutdown(c);
+            return 0;
+        }
+        memcpy(buf, packet, 32);
+        buf->full_sequence = c->in.request_read;
+        queue_skip(&c->in, 32);
+        if(!queue_event(c, buf, 0))
+            return 0;
+    }
+    return 1;
+}
+
+/* Copies the oldest event. Called with iolock held, so nothing is added to
+ * the ring meanwhile, but consumers may still be taking from it. */
+static int peek_event(xcb_connection_t *c, xcb_generic_event_t *event)
+{
+    for(;;)
+    {
+        unsigned int head = c->in.ring_head;
+        xcb_generic_event_t *volatile *slot;
+        xcb_generic_event_t *cur;
+        BARRIER();
+        if(head == c->in.ring_tail)
+            break;
+        slot = RING_SLOT(&c->in, head);
+        cur = *slot;
+        if(cur == RING_HOLE)
+        {
+            /* skip it, as a consumer would */
+            if(CAS(&c->in.ring_head, head, head + 1))
+                *slot = 0;
+            continue;
+        }
+        /* keep whoever claims it waiting until the copy is done */
+        if(!cur || !CAS(slot, cur, RING_BUSY))
+            continue;
+        memcpy(event, cur, sizeof(*event));
+        BARRIER();
+        *slot = cur;
+        return 1;
+    }
     if(!c->in.events)
         return 0;
-    ret = cur->event;
-    c->in.events = cur->next;
-    if(!cur->next)
-        c->in.events_tail = &c->in.events;
-    free(cur);
+    memcpy(event, c->in.events->event, sizeof(*event));
+    return 1;
+}
+
+/* Called with iolock held, so the ring is only drained concurrently. */
+static xcb_generic_event_t *get_event(xcb_connection_t *c)
+{
+    xcb_generic_event_t *ret = ring_take(&c->in);
+    if(!ret && c->in.events)
+    {
+        /* the ring is empty, so the list holds the oldest events */
+        refill_ring(c);
+        ret = ring_take(&c->in);
+    }
+    if(c->in.events)
+        refill_ring(c);
+    if(c->in.event_fd_ready && !have_events(c))
+        drain_event_fd(&c->in);
+    return ret;
+}
+
+/* Takes an event without iolock if one is ready in the ring. */
+static xcb_generic_event_t *get_event_unlocked(xcb_connection_t *c)
+{
+#if HAVE_SYNC_BUILTINS
+    xcb_generic_event_t *ret = ring_take(&c->in);
+    /* the event fd must stop being readable once the queue is empty */
+    if(ret && c->in.event_fd_ready && c->in.ring_head == c->in.ring_tail)
+    {
+        _xcb_lock_io(c);
+        if(c->in.event_fd_ready && !have_events(c))
+            drain_event_fd(&c->in);
+        pthread_mutex_unlock(&c->iolock);
+    }
     return ret;
+#else
+    return 0;
+#endif
+}
+
+static int get_events(xcb_connection_t *c, xcb_generic_event_t **events, int max)
+{
+    int count = 0;
+    while(count < max && (events[count] = get_event(c)))
+        ++count;
+    return count;
 }
 
 static void free_reply_list(struct reply_list *head)
@@ -256,7 +908,7 @@ static void free_reply_list(struct reply_list *head)
     {
         struct reply_list *cur = head;
         head = cur->next;
-        free(cur->reply);
+        free_reply(cur);
         free(cur);
     }
 }
@@ -312,9 +964,12 @@ static int poll_for_reply(xcb_connection_t *c, unsigned int request, void **repl
      * them all and they're in the replies map. */
     else if(XCB_SEQUENCE_COMPARE_32(request, <, c->in.request_read))
     {
-        head = _xcb_map_remove(c->in.replies, request);
+        head = _xcb_map_get(c->in.replies, request);
+        /* replacing the data of a present key cannot fail */
         if(head && head->next)
             _xcb_map_put(c->in.replies, request, head->next);
+        else if(head)
+            _xcb_map_remove(c->in.replies, request);
     }
     /* We're currently processing the responses to the request we want, and we
      * have a reply ready to return. So just return it without blocking. */
@@ -340,85 +995,110 @@ static int poll_for_reply(xcb_connection_t *c, unsigned int request, void **repl
 
     if(head)
     {
+        --c->stats.reply_queue_depth;
         if(((xcb_generic_reply_t *) head->reply)->response_type == XCB_ERROR)
         {
             if(error)
                 *error = head->reply;
             else
-                free(head->reply);
+                free_reply(head);
         }
         else
             *reply = head->reply;
 
-        free(head);
+        _xcb_freelist_put(&c->in.nodes, head);
     }
 
     return 1;
 }
 
-/* Public interface */
+/* Must be called with out.lock held. */
+static uint64_t widen(xcb_connection_t *c, unsigned int request)
+{
+    uint64_t widened_request = (c->out.request & UINT64_C(0xffffffff00000000)) | request;
+    if(widened_request > c->out.request)
+        widened_request -= UINT64_C(1) << 32;
+    return widened_request;
+}
 
-void *xcb_wait_for_reply(xcb_connection_t *c, unsigned int request, xcb_generic_error_t **e)
+/* Returns 1 once the reply or error is in, or known never to arrive, and 0
+ * if the deadline passes first. */
+static int wait_for_reply(xcb_connection_t *c, unsigned int request, const struct timespec *deadline, void **reply, xcb_generic_error_t **e)
 {
+    pthread_cond_t cond;
     uint64_t widened_request;
-    void *ret = 0;
+    int written, done = 0;
+    *reply = 0;
     if(e)
         *e = 0;
     if(c->has_error)
-        return 0;
-
-    pthread_mutex_lock(&c->iolock);
-
-    widened_request = (c->out.request & UINT64_C(0xffffffff00000000)) | request;
-    if(widened_request > c->out.request)
-        widened_request -= UINT64_C(1) << 32;
+        return 1;
 
     /* If this request has not been written yet, write it. */
-    if(c->out.return_socket || _xcb_out_flush_to(c, widened_request))
+    _xcb_lock_out(c);
+    widened_request = widen(c, request);
+    written = c->out.return_socket || _xcb_out_flush_to(c, widened_request);
+    pthread_mutex_unlock(&c->out.lock);
+
+    _xcb_lock_io(c);
+    if(written && _xcb_conn_cond_init(&cond))
+        _xcb_conn_shutdown(c);
+    else if(written)
     {
-        pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
         reader_list reader;
-        reader_list **prev_reader;
-
-        for(prev_reader = &c->in.readers; 
-	    *prev_reader && 
-	    XCB_SEQUENCE_COMPARE_32((*prev_reader)->request, <=, request);
-	    prev_reader = &(*prev_reader)->next)
-	{
-            /* empty */;
-	}
-        reader.request = request;
+
+        reader.request = widened_request;
         reader.data = &cond;
-        reader.next = *prev_reader;
-        *prev_reader = &reader;
+        reader.index = -1;
 
-        while(!poll_for_reply(c, request, &ret, e))
-            if(!_xcb_conn_wait(c, &cond, 0, 0))
+        if(!(done = poll_for_reply(c, request, reply, e)))
+            ++c->stats.round_trips;
+        while(!done)
+        {
+            /* (re-)register unless a previous wakeup left us registered */
+            if(reader.index < 0 && !insert_reader(c, &reader))
                 break;
-
-        for(prev_reader = &c->in.readers;
-	    *prev_reader && 
-	    XCB_SEQUENCE_COMPARE_32((*prev_reader)->request, <=, request);
-	    prev_reader = &(*prev_reader)->next)
-	{
-            if(*prev_reader == &reader)
-            {
-                *prev_reader = (*prev_reader)->next;
+            if(!_xcb_conn_wait(c, &cond, 0, 0, deadline))
                 break;
-            }
-	}
+            done = poll_for_reply(c, request, reply, e);
+            if(_xcb_conn_expired(deadline))
+                break;
+        }
+
+        /* Whether we got the reply or gave up, nobody may signal our
+         * condition variable once it is gone. */
+        if(reader.index >= 0)
+            remove_reader(c, &reader);
         pthread_cond_destroy(&cond);
     }
 
     _xcb_in_wake_up_next_reader(c);
     pthread_mutex_unlock(&c->iolock);
+    return done || c->has_error;
+}
+
+/* Public interface */
+
+void *xcb_wait_for_reply(xcb_connection_t *c, unsigned int request, xcb_generic_error_t **e)
+{
+    void *ret;
+    wait_for_reply(c, request, 0, &ret, e);
     return ret;
 }
 
-static void insert_pending_discard(xcb_connection_t *c, pending_reply **prev_next, uint64_t seq)
+int xcb_wait_for_reply_timeout(xcb_connection_t *c, unsigned int request, int timeout, void **reply, xcb_generic_error_t **e)
+{
+    struct timespec deadline;
+    _xcb_conn_deadline(&deadline, timeout);
+    return wait_for_reply(c, request, timeout < 0 ? 0 : &deadline, reply, e);
+}
+
+static void insert_pending_discard(xcb_connection_t *c, uint64_t seq)
 {
     pending_reply *pend;
-    pend = malloc(sizeof(*pend));
+    if(_xcb_map_get(c->in.discards, seq))
+        return;
+    pend = _xcb_freelist_get(&c->in.pending);
     if(!pend)
     {
         _xcb_conn_shutdown(c);
@@ -429,18 +1109,19 @@ static void insert_pending_discard(xcb_connection_t *c, pending_reply **prev_nex
     pend->last_request = seq;
     pend->workaround = 0;
     pend->flags = XCB_REQUEST_DISCARD_REPLY;
-    pend->next = *prev_next;
-    *prev_next = pend;
-
-    if(!pend->next)
-        c->in.pending_replies_tail = &pend->next;
+    pend->next = 0;
+    if(!_xcb_map_put(c->in.discards, seq, pend))
+    {
+        _xcb_freelist_put(&c->in.pending, pend);
+        _xcb_conn_shutdown(c);
+        return;
+    }
+    ++c->in.discards_len;
 }
 
-static void discard_reply(xcb_connection_t *c, unsigned int request)
+static void discard_reply(xcb_connection_t *c, unsigned int request, uint64_t widened_request)
 {
     pending_reply *pend = 0;
-    pending_reply **prev_pend;
-    uint64_t widened_request;
 
     /* We've read requests past the one we want, so if it has replies we have
      * them all and they're in the replies map. */
@@ -451,8 +1132,9 @@ static void discard_reply(xcb_connection_t *c, unsigned int request)
         while (head)
         {
             struct reply_list *next = head->next;
-            free(head->reply);
-            free(head);
+            --c->stats.reply_queue_depth;
+            free_reply(head);
+            _xcb_freelist_put(&c->in.nodes, head);
             head = next;
         }
         return;
@@ -470,49 +1152,36 @@ static void discard_reply(xcb_connection_t *c, unsigned int request)
         while (head)
         {
             struct reply_list *next = head->next;
-            free(head->reply);
-            free(head);
+            --c->stats.reply_queue_depth;
+            free_reply(head);
+            _xcb_freelist_put(&c->in.nodes, head);
             head = next;
         }
 
-        pend = c->in.pending_replies;
-        if(pend &&
-            !(XCB_SEQUENCE_COMPARE(pend->first_request, <=, c->in.request_read) &&
-             (pend->workaround == WORKAROUND_EXTERNAL_SOCKET_OWNER ||
-              XCB_SEQUENCE_COMPARE(c->in.request_read, <=, pend->last_request))))
-            pend = 0;
+        pend = current_pending(c);
         if(pend)
             pend->flags |= XCB_REQUEST_DISCARD_REPLY;
         else
-            insert_pending_discard(c, &c->in.pending_replies, c->in.request_read);
+            insert_pending_discard(c, c->in.request_read);
 
         return;
     }
 
-    /* Walk the list of pending requests. Mark the first match for deletion. */
-    for(prev_pend = &c->in.pending_replies; *prev_pend; prev_pend = &(*prev_pend)->next)
+    /* Look up the pending request. Mark the match for deletion. */
+    pend = _xcb_map_get(c->in.pending_index, request);
+    if(pend)
     {
-        if(XCB_SEQUENCE_COMPARE_32((*prev_pend)->first_request, >, request))
-            break;
-
-        if(XCB_SEQUENCE_COMPARE_32((*prev_pend)->first_request, ==, request))
-        {
-            /* Pending reply found. Mark for discard: */
-            (*prev_pend)->flags |= XCB_REQUEST_DISCARD_REPLY;
-            return;
-        }
+        pend->flags |= XCB_REQUEST_DISCARD_REPLY;
+        return;
     }
 
     /* Pending reply not found (likely due to _unchecked request). Create one: */
-    widened_request = (c->out.request & UINT64_C(0xffffffff00000000)) | request;
-    if(widened_request > c->out.request)
-        widened_request -= UINT64_C(1) << 32;
-
-    insert_pending_discard(c, prev_pend, widened_request);
+    insert_pending_discard(c, widened_request);
 }
 
 void xcb_discard_reply(xcb_connection_t *c, unsigned int sequence)
 {
+    uint64_t widened_request;
     if(c->has_error)
         return;
 
@@ -520,8 +1189,12 @@ void xcb_discard_reply(xcb_connection_t *c, unsigned int sequence)
     if(!sequence)
         return;
 
-    pthread_mutex_lock(&c->iolock);
-    discard_reply(c, sequence);
+    _xcb_lock_out(c);
+    widened_request = widen(c, sequence);
+    pthread_mutex_unlock(&c->out.lock);
+
+    _xcb_lock_io(c);
+    discard_reply(c, sequence, widened_request);
     pthread_mutex_unlock(&c->iolock);
 }
 
@@ -536,34 +1209,56 @@ int xcb_poll_for_reply(xcb_connection_t *c, unsigned int request, void **reply,
         return 1; /* would not block */
     }
     assert(reply != 0);
-    pthread_mutex_lock(&c->iolock);
+    _xcb_lock_io(c);
     ret = poll_for_reply(c, request, reply, error);
     pthread_mutex_unlock(&c->iolock);
     return ret;
 }
 
-xcb_generic_event_t *xcb_wait_for_event(xcb_connection_t *c)
+static xcb_generic_event_t *wait_for_event(xcb_connection_t *c, const struct timespec *deadline)
 {
     xcb_generic_event_t *ret;
     if(c->has_error)
         return 0;
-    pthread_mutex_lock(&c->iolock);
+    if((ret = get_event_unlocked(c)))
+        return ret;
+    _xcb_lock_io(c);
     /* get_event returns 0 on empty list. */
     while(!(ret = get_event(c)))
-        if(!_xcb_conn_wait(c, &c->in.event_cond, 0, 0))
+    {
+        if(!_xcb_conn_wait(c, &c->in.event_cond, 0, 0, deadline))
+            break;
+        if(_xcb_conn_expired(deadline))
+        {
+            /* one last look, in case the final wait read something */
+            ret = get_event(c);
             break;
+        }
+    }
 
     _xcb_in_wake_up_next_reader(c);
     pthread_mutex_unlock(&c->iolock);
     return ret;
 }
 
+xcb_generic_event_t *xcb_wait_for_event(xcb_connection_t *c)
+{
+    return wait_for_event(c, 0);
+}
+
+xcb_generic_event_t *xcb_wait_for_event_timeout(xcb_connection_t *c, int timeout)
+{
+    struct timespec deadline;
+    _xcb_conn_deadline(&deadline, timeout);
+    return wait_for_event(c, timeout < 0 ? 0 : &deadline);
+}
+
 xcb_generic_event_t *xcb_poll_for_event(xcb_connection_t *c)
 {
     xcb_generic_event_t *ret = 0;
-    if(!c->has_error)
+    if(!c->has_error && !(ret = get_event_unlocked(c)))
     {
-        pthread_mutex_lock(&c->iolock);
+        _xcb_lock_io(c);
         /* FIXME: follow X meets Z architecture changes. */
         ret = get_event(c);
         if(!ret && _xcb_in_read(c)) /* _xcb_in_read shuts down the connection on error */
@@ -573,6 +1268,229 @@ xcb_generic_event_t *xcb_poll_for_event(xcb_connection_t *c)
     return ret;
 }
 
+xcb_generic_event_t *xcb_poll_for_queued_event(xcb_connection_t *c)
+{
+    xcb_generic_event_t *ret = 0;
+    if(!c->has_error && !(ret = get_event_unlocked(c)))
+    {
+        _xcb_lock_io(c);
+        ret = get_event(c);
+        pthread_mutex_unlock(&c->iolock);
+    }
+    return ret;
+}
+
+int xcb_peek_event(xcb_connection_t *c, xcb_generic_event_t *event)
+{
+    int ret = 0;
+    if(!c->has_error)
+    {
+        _xcb_lock_io(c);
+        ret = peek_event(c, event);
+        pthread_mutex_unlock(&c->iolock);
+    }
+    return ret;
+}
+
+int xcb_wait_for_events(xcb_connection_t *c, xcb_generic_event_t **events, int max)
+{
+    int ret = 0;
+    if(c->has_error || max <= 0)
+        return 0;
+    _xcb_lock_io(c);
+    while(!(ret = get_events(c, events, max)))
+        if(!_xcb_conn_wait(c, &c->in.event_cond, 0, 0, 0))
+            break;
+
+    _xcb_in_wake_up_next_reader(c);
+    pthread_mutex_unlock(&c->iolock);
+    return ret;
+}
+
+int xcb_poll_for_events(xcb_connection_t *c, xcb_generic_event_t **events, int max)
+{
+    int ret = 0;
+    if(!c->has_error && max > 0)
+    {
+        _xcb_lock_io(c);
+        ret = get_events(c, events, max);
+        if(!ret && _xcb_in_read(c)) /* _xcb_in_read shuts down the connection on error */
+            ret = get_events(c, events, max);
+        pthread_mutex_unlock(&c->iolock);
+    }
+    return ret;
+}
+
+void xcb_release_event(xcb_connection_t *c, xcb_generic_event_t *event)
+{
+    if(!event)
+        return;
+    _xcb_lock_io(c);
+    if(c->has_error || !is_event_buffer(event))
+        free_buffer(&c->in, event);
+    else
+        put_event_buffer(&c->in, event);
+    pthread_mutex_unlock(&c->iolock);
+}
+
+int xcb_get_event_fd(xcb_connection_t *c)
+{
+#ifdef _WIN32
+    return -1;
+#else
+    int ret;
+    if(c->has_error)
+        return -1;
+    _xcb_lock_io(c);
+    if(c->in.event_fd[0] < 0)
+    {
+#if HAVE_SYS_EVENTFD_H
+        c->in.event_fd[0] = c->in.event_fd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#else
+        int i;
+        if(pipe(c->in.event_fd) == 0)
+            for(i = 0; i < 2; ++i)
+            {
+                fcntl(c->in.event_fd[i], F_SETFL, O_NONBLOCK);
+                fcntl(c->in.event_fd[i], F_SETFD, FD_CLOEXEC);
+            }
+        else
+            c->in.event_fd[0] = c->in.event_fd[1] = -1;
+#endif
+        if(have_events(c))
+            signal_event_fd(&c->in);
+    }
+    ret = c->in.event_fd[0];
+    pthread_mutex_unlock(&c->iolock);
+    return ret;
+#endif
+}
+
+int xcb_set_allocator(xcb_connection_t *c, xcb_alloc_func_t alloc, xcb_free_func_t release, void *data)
+{
+    int ret = 0;
+    if(c->has_error || !alloc != !release)
+        return 0;
+    _xcb_lock_out(c);
+    _xcb_lock_io(c);
+    /* every buffer must go back to the allocator it came from */
+    if(!c->out.request)
+    {
+        _xcb_freelist_destroy(&c->in.event_buffers);
+        c->in.alloc = alloc;
+        c->in.release = release;
+        c->in.alloc_data = data;
+        ret = 1;
+    }
+    pthread_mutex_unlock(&c->iolock);
+    pthread_mutex_unlock(&c->out.lock);
+    return ret;
+}
+
+int xcb_set_reply_buffer(xcb_connection_t *c, unsigned int sequence, void *buffer, size_t size)
+{
+    reply_buffer *dest;
+    int ret = 0;
+    if(c->has_error || !sequence || size < sizeof(xcb_generic_reply_t))
+        return 0;
+    _xcb_lock_io(c);
+    if(!c->in.reply_buffers)
+        c->in.reply_buffers = _xcb_map_new();
+    /* too late if the reply may already be in */
+    if(c->in.reply_buffers && XCB_SEQUENCE_COMPARE_32(sequence, >, c->in.request_read))
+    {
+        dest = malloc(sizeof(reply_buffer));
+        if(dest)
+        {
+            dest->buffer = buffer;
+            dest->size = size;
+            free(_xcb_map_remove(c->in.reply_buffers, sequence));
+            ret = _xcb_map_put(c->in.reply_buffers, sequence, dest);
+            if(!ret)
+                free(dest);
+        }
+    }
+    pthread_mutex_unlock(&c->iolock);
+    return ret;
+}
+
+static int set_handler(event_handler *handler, xcb_event_handler_t func, void *data)
+{
+    handler->handler = func;
+    handler->data = data;
+    return 1;
+}
+
+static int init_handlers(xcb_connection_t *c)
+{
+    if(!c->in.handlers)
+        c->in.handlers = calloc(XCB_HANDLER_TYPES, sizeof(event_handler));
+    return c->in.handlers != 0;
+}
+
+int xcb_set_event_handler(xcb_connection_t *c, uint8_t response_type, xcb_event_handler_t handler, void *data)
+{
+    int ret;
+    if(c->has_error)
+        return 0;
+    if(response_type == XCB_REPLY || response_type == XCB_XGE_EVENT || response_type >= XCB_HANDLER_TYPES)
+        return 0;
+    _xcb_lock_io(c);
+    ret = init_handlers(c) && set_handler(c->in.handlers + response_type, handler, data);
+    pthread_mutex_unlock(&c->iolock);
+    return ret;
+}
+
+int xcb_dispatch_events(xcb_connection_t *c)
+{
+    int ret;
+    if(c->has_error)
+        return 0;
+    _xcb_lock_io(c);
+    ret = _xcb_in_read(c);
+    pthread_mutex_unlock(&c->iolock);
+    return ret;
+}
+
+int xcb_set_event_coalescing(xcb_connection_t *c, uint8_t response_type, xcb_event_coalescing_t policy, unsigned int key_offset, xcb_event_merge_func_t merge, void *data)
+{
+    event_coalescing *coalescing;
+    int ret = 1;
+    if(c->has_error)
+        return 0;
+    if(response_type < 2 || response_type >= XCB_COALESCING_TYPES || response_type == XCB_XGE_EVENT)
+        return 0;
+    if(policy != XCB_COALESCE_NONE &&
+       (key_offset > 32 - sizeof(uint32_t) || (policy == XCB_COALESCE_MERGE && !merge)))
+        return 0;
+
+    _xcb_lock_io(c);
+    if(!c->in.coalescing)
+        c->in.coalescing = calloc(XCB_COALESCING_TYPES, sizeof(event_coalescing));
+    if(!c->in.coalescing)
+    {
+        pthread_mutex_unlock(&c->iolock);
+        return 0;
+    }
+    coalescing = c->in.coalescing + response_type;
+
+    /* events queued under the old policy are left alone */
+    _xcb_map_delete(coalescing->queued, 0);
+    coalescing->queued = 0;
+    if(policy != XCB_COALESCE_NONE)
+    {
+        coalescing->queued = _xcb_map_new();
+        if(!coalescing->queued)
+            ret = 0;
+    }
+    coalescing->policy = policy;
+    coalescing->key_offset = key_offset;
+    coalescing->merge = merge;
+    coalescing->data = data;
+    pthread_mutex_unlock(&c->iolock);
+    return ret;
+}
+
 xcb_generic_error_t *xcb_request_check(xcb_connection_t *c, xcb_void_cookie_t cookie)
 {
     /* FIXME: this could hold the lock to avoid syncing unnecessarily, but
@@ -580,12 +1498,16 @@ xcb_generic_error_t *xcb_request_check(xcb_connection_t *c, xcb_void_cookie_t co
      * xcb_get_input_focus_reply, and xcb_wait_for_reply. */
     xcb_generic_error_t *ret;
     void *reply;
+    uint64_t request_expected;
     if(c->has_error)
         return 0;
-    if(XCB_SEQUENCE_COMPARE_32(cookie.sequence,>=,c->in.request_expected)
+    pthread_mutex_lock(&c->in.expected_lock);
+    request_expected = c->in.request_expected;
+    pthread_mutex_unlock(&c->in.expected_lock);
+    if(XCB_SEQUENCE_COMPARE_32(cookie.sequence,>=,request_expected)
        && XCB_SEQUENCE_COMPARE_32(cookie.sequence,>,c->in.request_completed))
     {
-        free(xcb_get_input_focus_reply(c, xcb_get_input_focus(c), &ret));
+        _xcb_in_free_reply(c, xcb_get_input_focus_reply(c, xcb_get_input_focus(c), &ret));
         assert(!ret);
     }
     reply = xcb_wait_for_reply(c, cookie.sequence, &ret);
@@ -593,15 +1515,78 @@ xcb_generic_error_t *xcb_request_check(xcb_connection_t *c, xcb_void_cookie_t co
     return ret;
 }
 
+int xcb_request_check_many(xcb_connection_t *c, const xcb_void_cookie_t *cookies, unsigned int n, xcb_generic_error_t **errors)
+{
+    uint64_t highest = 0, request_expected;
+    unsigned int i, last = n;
+    int count = 0;
+    void *reply;
+
+    for(i = 0; i < n; ++i)
+        errors[i] = 0;
+    if(c->has_error)
+        return 0;
+
+    /* Sequence numbers only order correctly once widened. */
+    _xcb_lock_out(c);
+    for(i = 0; i < n; ++i)
+    {
+        uint64_t request;
+        if(!cookies[i].sequence)
+            continue;
+        request = widen(c, cookies[i].sequence);
+        if(last == n || request > highest)
+        {
+            highest = request;
+            last = i;
+        }
+    }
+    pthread_mutex_unlock(&c->out.lock);
+    if(last == n)
+        return 0;
+
+    /* A reply-bearing request sent after the last cookie, whether ours or
+     * the application's, already proves when the others have completed.
+     * Otherwise one sync does, and nobody needs its reply. */
+    pthread_mutex_lock(&c->in.expected_lock);
+    request_expected = c->in.request_expected;
+    pthread_mutex_unlock(&c->in.expected_lock);
+    if(XCB_SEQUENCE_COMPARE(highest, >=, request_expected)
+       && XCB_SEQUENCE_COMPARE_32(cookies[last].sequence, >, c->in.request_completed))
+    {
+        xcb_discard_reply(c, xcb_get_input_focus(c).sequence);
+        xcb_flush(c);
+    }
+
+    wait_for_reply(c, cookies[last].sequence, 0, &reply, &errors[last]);
+    assert(!reply);
+
+    /* Every other cookie is now complete, so its error is already here. */
+    _xcb_lock_io(c);
+    for(i = 0; i < n; ++i)
+    {
+        if(i != last && !poll_for_reply(c, cookies[i].sequence, &reply, &errors[i]))
+            errors[i] = 0;
+        if(errors[i])
+            ++count;
+    }
+    pthread_mutex_unlock(&c->iolock);
+    return count;
+}
+
 /* Private interface */
 
 int _xcb_in_init(_xcb_in *in)
 {
-    if(pthread_cond_init(&in->event_cond, 0))
+    if(_xcb_conn_cond_init(&in->event_cond))
+        return 0;
+    if(pthread_mutex_init(&in->expected_lock, 0))
         return 0;
     in->reading = 0;
+    in->event_fd[0] = in->event_fd[1] = -1;
 
     in->queue_len = 0;
+    in->queue_head = 0;
 
     in->request_read = 0;
     in->request_completed = 0;
@@ -609,24 +1594,49 @@ int _xcb_in_init(_xcb_in *in)
     in->replies = _xcb_map_new();
     if(!in->replies)
         return 0;
+    in->pending_index = _xcb_map_new();
+    if(!in->pending_index)
+        return 0;
+    in->discards = _xcb_map_new();
+    if(!in->discards)
+        return 0;
 
     in->current_reply_tail = &in->current_reply;
     in->events_tail = &in->events;
+    in->events_len = 0;
     in->pending_replies_tail = &in->pending_replies;
 
+    _xcb_freelist_init(&in->nodes, sizeof(struct event_list) > sizeof(struct reply_list) ?
+            sizeof(struct event_list) : sizeof(struct reply_list), XCB_FREELIST_MAX);
+    _xcb_freelist_init(&in->pending, sizeof(pending_reply), XCB_FREELIST_MAX);
+    _xcb_freelist_init(&in->event_buffers, XCB_EVENT_BUFFER_SIZE, XCB_FREELIST_MAX);
+
     return 1;
 }
 
 void _xcb_in_destroy(_xcb_in *in)
 {
     pthread_cond_destroy(&in->event_cond);
+    pthread_mutex_destroy(&in->expected_lock);
+#ifndef _WIN32
+    if(in->event_fd[0] >= 0)
+        close(in->event_fd[0]);
+    if(in->event_fd[1] >= 0 && in->event_fd[1] != in->event_fd[0])
+        close(in->event_fd[1]);
+#endif
     free_reply_list(in->current_reply);
     _xcb_map_delete(in->replies, (void (*)(void *)) free_reply_list);
+    for(; in->ring_head != in->ring_tail; ++in->ring_head)
+    {
+        xcb_generic_event_t *event = *RING_SLOT(in, in->ring_head);
+        if(event != RING_HOLE)
+            free_buffer(in, event);
+    }
     while(in->events)
     {
         struct event_list *e = in->events;
         in->events = e->next;
-        free(e->event);
+        free_buffer(in, e->event);
         free(e);
     }
     while(in->pending_replies)
@@ -635,13 +1645,39 @@ void _xcb_in_destroy(_xcb_in *in)
         in->pending_replies = pend->next;
         free(pend);
     }
+    free(in->handlers);
+    _xcb_map_delete(in->ge_handlers, free);
+    if(in->coalescing)
+    {
+        int i;
+        for(i = 0; i < XCB_COALESCING_TYPES; ++i)
+            _xcb_map_delete(in->coalescing[i].queued, 0);
+        free(in->coalescing);
+    }
+    _xcb_map_delete(in->pending_index, 0);
+    _xcb_map_delete(in->discards, free);
+    _xcb_map_delete(in->reply_buffers, free);
+    free(in->readers);
+    _xcb_freelist_destroy(&in->nodes);
+    _xcb_freelist_destroy(&in->pending);
+    _xcb_freelist_destroy(&in->event_buffers);
+}
+
+/* For replies and errors XCB collects for itself, which come from the
+ * application's allocator if it set one. */
+void _xcb_in_free_reply(xcb_connection_t *c, void *reply)
+{
+    free_buffer(&c->in, reply);
 }
 
 void _xcb_in_wake_up_next_reader(xcb_connection_t *c)
 {
     int pthreadret;
-    if(c->in.readers)
-        pthreadret = pthread_cond_signal(c->in.readers->data);
+    /* the reader thread signals each waiter itself */
+    if(c->in.has_reader_thread && !c->has_error)
+        return;
+    if(c->in.readers_len)
+        pthreadret = pthread_cond_signal(c->in.readers[0]->data);
     else
         pthreadret = pthread_cond_signal(&c->in.event_cond);
     assert(pthreadret == 0);
@@ -649,7 +1685,7 @@ void _xcb_in_wake_up_next_reader(xcb_connection_t *c)
 
 int _xcb_in_expect_reply(xcb_connection_t *c, uint64_t request, enum workarounds workaround, int flags)
 {
-    pending_reply *pend = malloc(sizeof(pending_reply));
+    pending_reply *pend = _xcb_freelist_get(&c->in.pending);
     assert(workaround != WORKAROUND_NONE || flags != 0);
     if(!pend)
     {
@@ -660,6 +1696,13 @@ int _xcb_in_expect_reply(xcb_connection_t *c, uint64_t request, enum workarounds
     pend->workaround = workaround;
     pend->flags = flags;
     pend->next = 0;
+    if(workaround != WORKAROUND_EXTERNAL_SOCKET_OWNER &&
+       !_xcb_map_put(c->in.pending_index, request, pend))
+    {
+        _xcb_freelist_put(&c->in.pending, pend);
+        _xcb_conn_shutdown(c);
+        return 0;
+    }
     *c->in.pending_replies_tail = pend;
     c->in.pending_replies_tail = &pend->next;
     return 1;
@@ -679,12 +1722,81 @@ void _xcb_in_replies_done(xcb_connection_t *c)
     }
 }
 
+int _xcb_in_set_ge_event_handler(xcb_connection_t *c, uint8_t extension, uint16_t event_type, xcb_event_handler_t handler, void *data)
+{
+    unsigned int key = GE_HANDLER_KEY(extension, event_type);
+    event_handler *cur;
+    /* the handlers table must exist for read_packet to look any further */
+    if(!init_handlers(c))
+        return 0;
+    if(!c->in.ge_handlers)
+        c->in.ge_handlers = _xcb_map_new();
+    if(!c->in.ge_handlers)
+        return 0;
+    cur = _xcb_map_get(c->in.ge_handlers, key);
+    if(!handler)
+    {
+        free(_xcb_map_remove(c->in.ge_handlers, key));
+        return 1;
+    }
+    if(!cur)
+    {
+        cur = malloc(sizeof(event_handler));
+        if(!cur)
+            return 0;
+        if(!_xcb_map_put(c->in.ge_handlers, key, cur))
+        {
+            free(cur);
+            return 0;
+        }
+    }
+    return set_handler(cur, handler, data);
+}
+
 int _xcb_in_read(xcb_connection_t *c)
 {
-    int n = recv(c->fd, c->in.queue + c->in.queue_len, sizeof(c->in.queue) - c->in.queue_len,MSG_WAITALL);
+    int n;
+    int tail = c->in.queue_head + c->in.queue_len;
+#ifndef _WIN32
+    struct iovec vec[2];
+    int count = 1;
+    if(tail >= (int) sizeof(c->in.queue))
+    {
+        tail -= sizeof(c->in.queue);
+        vec[0].iov_base = c->in.queue + tail;
+        vec[0].iov_len = c->in.queue_head - tail;
+    }
+    else
+    {
+        /* fill to the end of the ring, then wrap around to its start */
+        vec[0].iov_base = c->in.queue + tail;
+        vec[0].iov_len = sizeof(c->in.queue) - tail;
+        vec[1].iov_base = c->in.queue;
+        vec[1].iov_len = c->in.queue_head;
+        if(c->in.queue_head)
+            ++count;
+    }
+    n = readv(c->fd, vec, count);
+#else
+    int len;
+    if(tail >= (int) sizeof(c->in.queue))
+    {
+        tail -= sizeof(c->in.queue);
+        len = c->in.queue_head - tail;
+    }
+    else
+        len = sizeof(c->in.queue) - tail;
+    n = recv(c->fd, c->in.queue + tail, len, 0);
+#endif /* !_WIN32 */
     if(n > 0)
+    {
         c->in.queue_len += n;
-    while(read_packet(c))
+        c->stats.bytes_read += n;
+#ifndef _WIN32
+        CAPTURE(c, XCB_CAPTURE_READ, c->in.request_read, vec, count, n);
+#endif
+    }
+    while(read_packet(c) && read_events(c))
         /* empty */;
 #ifndef _WIN32
     if((n > 0) || (n < 0 && errno == EAGAIN))
@@ -702,9 +1814,8 @@ int _xcb_in_read_block(xcb_connection_t *c, void *buf, int len)
     if(len < done)
         done = len;
 
-    memcpy(buf, c->in.queue, done);
-    c->in.queue_len -= done;
-    memmove(c->in.queue, c->in.queue + done, c->in.queue_len);
+    queue_peek(&c->in, buf, done);
+    queue_skip(&c->in, done);
 
     if(len > done)
     {
@@ -714,6 +1825,16 @@ int _xcb_in_read_block(xcb_connection_t *c, void *buf, int len)
             _xcb_conn_shutdown(c);
             return ret;
         }
+        c->stats.bytes_read += len - done;
+#if XCB_TRACING
+        if(c->capture)
+        {
+            struct iovec vec;
+            vec.iov_base = (char *) buf + done;
+            vec.iov_len = len - done;
+            _xcb_capture(c, XCB_CAPTURE_READ, c->in.request_read, &vec, 1, len - done);
+        }
+#endif
     }
 
     return len;
@@ -23,79 +23,216 @@
  * authorization from the authors.
  */
 
-/* A generic implementation of a list of void-pointers. */
+/* A map from sequence numbers to void-pointers, and a free list of
+ * fixed-size objects. */
 
 #include <stdlib.h>
 
 #include "xcb.h"
 #include "xcbint.h"
 
+/* The map is an open-addressing hash table using Robin Hood linear
+ * probing. Keys are mostly consecutive sequence numbers, so the key itself,
+ * masked to the table size, is used as the hash: outstanding sequence
+ * numbers land in consecutive slots and rarely collide. Robin Hood ordering
+ * lets lookups of absent keys and deletions stop after a slot or two even
+ * inside a long run of occupied slots. A null data pointer marks an empty
+ * slot. */
+
+#define MAP_INITIAL_SIZE 16
+
 typedef struct node {
-    struct node *next;
     unsigned int key;
     void *data;
 } node;
 
 struct _xcb_map {
-    node *head;
-    node **tail;
+    node *nodes;
+    unsigned int mask;
+    unsigned int count;
 };
 
+/* How far the node in slot i is from the slot its key hashes to. */
+static unsigned int distance(const _xcb_map *map, unsigned int i)
+{
+    return (i - map->nodes[i].key) & map->mask;
+}
+
+static node *find(_xcb_map *map, unsigned int key)
+{
+    unsigned int i, dist;
+    for(i = key & map->mask, dist = 0; map->nodes[i].data; i = (i + 1) & map->mask, ++dist)
+    {
+        if(map->nodes[i].key == key)
+            return map->nodes + i;
+        if(distance(map, i) < dist)
+            break;
+    }
+    return 0;
+}
+
+static void insert(_xcb_map *map, unsigned int key, void *data)
+{
+    node cur;
+    unsigned int i, dist;
+    cur.key = key;
+    cur.data = data;
+    for(i = key & map->mask, dist = 0; map->nodes[i].data; i = (i + 1) & map->mask, ++dist)
+    {
+        /* displace nodes that are closer to home than the one we carry */
+        if(distance(map, i) < dist)
+        {
+            node tmp = map->nodes[i];
+            dist = distance(map, i);
+            map->nodes[i] = cur;
+            cur = tmp;
+        }
+    }
+    map->nodes[i] = cur;
+    ++map->count;
+}
+
+static int grow(_xcb_map *map)
+{
+    node *old = map->nodes;
+    unsigned int i, old_size = map->mask + 1;
+    node *nodes = calloc(old_size * 2, sizeof(node));
+    if(!nodes)
+        return 0;
+    map->nodes = nodes;
+    map->mask = old_size * 2 - 1;
+    map->count = 0;
+    for(i = 0; i < old_size; ++i)
+        if(old[i].data)
+            insert(map, old[i].key, old[i].data);
+    free(old);
+    return 1;
+}
+
 /* Private interface */
 
 _xcb_map *_xcb_map_new()
 {
-    _xcb_map *list;
-    list = malloc(sizeof(_xcb_map));
-    if(!list)
+    _xcb_map *map;
+    map = malloc(sizeof(_xcb_map));
+    if(!map)
         return 0;
-    list->head = 0;
-    list->tail = &list->head;
-    return list;
+    map->nodes = calloc(MAP_INITIAL_SIZE, sizeof(node));
+    if(!map->nodes)
+    {
+        free(map);
+        return 0;
+    }
+    map->mask = MAP_INITIAL_SIZE - 1;
+    map->count = 0;
+    return map;
 }
 
-void _xcb_map_delete(_xcb_map *list, xcb_list_free_func_t do_free)
+void _xcb_map_delete(_xcb_map *map, xcb_list_free_func_t do_free)
 {
-    if(!list)
+    unsigned int i;
+    if(!map)
         return;
-    while(list->head)
+    if(do_free)
+        for(i = 0; i <= map->mask; ++i)
+            if(map->nodes[i].data)
+                do_free(map->nodes[i].data);
+    free(map->nodes);
+    free(map);
+}
+
+/* Keys must be unique: putting a key that is already present replaces its
+ * data. */
+int _xcb_map_put(_xcb_map *map, unsigned int key, void *data)
+{
+    node *cur = find(map, key);
+    if(cur)
     {
-        node *cur = list->head;
-        if(do_free)
-            do_free(cur->data);
-        list->head = cur->next;
-        free(cur);
+        cur->data = data;
+        return 1;
     }
-    free(list);
+    /* keep the table at most half full so probe sequences stay short */
+    if((map->count + 1) * 2 > map->mask + 1 && !grow(map))
+        return 0;
+    insert(map, key, data);
+    return 1;
+}
+
+void *_xcb_map_get(_xcb_map *map, unsigned int key)
+{
+    node *cur = find(map, key);
+    return cur ? cur->data : 0;
 }
 
-int _xcb_map_put(_xcb_map *list, unsigned int key, void *data)
+void *_xcb_map_remove(_xcb_map *map, unsigned int key)
 {
-    node *cur = malloc(sizeof(node));
+    node *cur = find(map, key);
+    unsigned int i, j;
+    void *ret;
     if(!cur)
         return 0;
-    cur->key = key;
-    cur->data = data;
-    cur->next = 0;
-    *list->tail = cur;
-    list->tail = &cur->next;
-    return 1;
+    ret = cur->data;
+    --map->count;
+
+    /* Shift the rest of the run back into the hole, so lookups never need
+     * tombstones. The run ends at an empty slot or at a node already in its
+     * home slot. */
+    i = cur - map->nodes;
+    for(j = (i + 1) & map->mask; map->nodes[j].data && distance(map, j); j = (j + 1) & map->mask)
+    {
+        map->nodes[i] = map->nodes[j];
+        i = j;
+    }
+    map->nodes[i].data = 0;
+    return ret;
 }
 
-void *_xcb_map_remove(_xcb_map *list, unsigned int key)
+/* A free list caches up to max released objects of one fixed size, so
+ * steady-state allocation does not go through malloc. Every object is
+ * individually malloc'd: callers may hand one to free() instead of
+ * returning it to the list. */
+
+void _xcb_freelist_init(_xcb_freelist *list, size_t size, int max)
 {
-    node **cur;
-    for(cur = &list->head; *cur; cur = &(*cur)->next)
-        if((*cur)->key == key)
-        {
-            node *tmp = *cur;
-            void *ret = (*cur)->data;
-            *cur = (*cur)->next;
-            if(!*cur)
-                list->tail = cur;
-
-            free(tmp);
-            return ret;
-        }
-    return 0;
+    if(size < sizeof(void *))
+        size = sizeof(void *);
+    list->head = 0;
+    list->size = size;
+    list->count = 0;
+    list->max = max;
+}
+
+void _xcb_freelist_destroy(_xcb_freelist *list)
+{
+    while(list->head)
+    {
+        void *cur = list->head;
+        list->head = *(void **) cur;
+        free(cur);
+    }
+    list->count = 0;
+}
+
+void *_xcb_freelist_get(_xcb_freelist *list)
+{
+    void *ret = list->head;
+    if(!ret)
+        return malloc(list->size);
+    list->head = *(void **) ret;
+    --list->count;
+    return ret;
+}
+
+void _xcb_freelist_put(_xcb_freelist *list, void *obj)
+{
+    if(!obj)
+        return;
+    if(list->count >= list->max)
+    {
+        free(obj);
+        return;
+    }
+    *(void **) obj = list->head;
+    list->head = obj;
+    ++list->count;
 }
@@ -35,9 +35,81 @@
 #include "xcbint.h"
 #include "bigreq.h"
 
+static size_t request_bytes(const struct iovec *vector, int count)
+{
+    size_t bytes = 0;
+    while(count--)
+        bytes += vector[count].iov_len;
+    return bytes;
+}
+
+static int grow_queue(xcb_connection_t *c, size_t len)
+{
+    size_t size = c->out.queue_size;
+    char *queue;
+    while(size < len)
+        size *= 2;
+    queue = realloc(c->out.queue, size);
+    if(!queue)
+        return 0;
+    c->out.queue = queue;
+    c->out.queue_size = size;
+    return 1;
+}
+
+static void shrink_buffer(char **buffer, int *size)
+{
+    char *smaller;
+    if(*size <= XCB_QUEUE_BUFFER_SIZE)
+        return;
+    smaller = realloc(*buffer, XCB_QUEUE_BUFFER_SIZE);
+    /* on failure, keep using the bigger one */
+    if(!smaller)
+        return;
+    *buffer = smaller;
+    *size = XCB_QUEUE_BUFFER_SIZE;
+}
+
+/* Makes room to queue len more bytes behind a write in progress, up to
+ * XCB_QUEUE_BUFFER_MAX in all. */
+static int reserve_queue(xcb_connection_t *c, size_t len)
+{
+    len += c->out.queue_len;
+    if(len <= (size_t) c->out.queue_size)
+        return 1;
+    return len <= XCB_QUEUE_BUFFER_MAX && grow_queue(c, len);
+}
+
+/* Writes the vector, whose first element is the whole queue, after
+ * swapping in the spare buffer for senders to fill meanwhile. */
+static int send_queue(xcb_connection_t *c, struct iovec *vector, int count)
+{
+    char *front = c->out.queue;
+    int front_size = c->out.queue_size, ret;
+
+    assert(!c->out.writing && c->out.spare);
+    c->out.queue = c->out.spare;
+    c->out.queue_size = c->out.spare_size;
+    c->out.queue_len = 0;
+    c->out.spare = 0;
+
+    ret = _xcb_out_send(c, vector, count);
+
+    /* once no more than the initial size queued up behind a write, any
+     * burst that grew the buffers is over */
+    if(c->out.queue_len <= XCB_QUEUE_BUFFER_SIZE)
+    {
+        shrink_buffer(&front, &front_size);
+        shrink_buffer(&c->out.queue, &c->out.queue_size);
+    }
+    c->out.spare = front;
+    c->out.spare_size = front_size;
+    return ret;
+}
+
 static int write_block(xcb_connection_t *c, struct iovec *vector, int count)
 {
-    while(count && c->out.queue_len + vector[0].iov_len <= sizeof(c->out.queue))
+    while(count && c->out.queue_len + vector[0].iov_len <= (size_t) c->out.queue_size)
     {
         memcpy(c->out.queue + c->out.queue_len, vector[0].iov_base, vector[0].iov_len);
         c->out.queue_len += vector[0].iov_len;
@@ -48,30 +120,50 @@ static int write_block(xcb_connection_t *c, struct iovec *vector, int count)
     if(!count)
         return 1;
 
+    /* xcb_send_request made room for the whole request behind any write
+     * in progress, so the queue only overflows when nothing is writing */
+    assert(!c->out.writing);
     --vector, ++count;
     vector[0].iov_base = c->out.queue;
     vector[0].iov_len = c->out.queue_len;
-    c->out.queue_len = 0;
-    return _xcb_out_send(c, vector, count);
+    return send_queue(c, vector, count);
+}
+
+static int need_sync(xcb_connection_t *c)
+{
+    int ret;
+    pthread_mutex_lock(&c->in.expected_lock);
+    ret = c->out.request == c->in.request_expected + (1 << 16) - 1;
+    pthread_mutex_unlock(&c->in.expected_lock);
+    return ret;
+}
+
+static void set_request_expected(xcb_connection_t *c, uint64_t request)
+{
+    pthread_mutex_lock(&c->in.expected_lock);
+    c->in.request_expected = request;
+    pthread_mutex_unlock(&c->in.expected_lock);
 }
 
 static void get_socket_back(xcb_connection_t *c)
 {
     while(c->out.return_socket && c->out.socket_moving)
-        pthread_cond_wait(&c->out.socket_cond, &c->iolock);
+        pthread_cond_wait(&c->out.socket_cond, &c->out.lock);
     if(!c->out.return_socket)
         return;
 
     c->out.socket_moving = 1;
-    pthread_mutex_unlock(&c->iolock);
+    pthread_mutex_unlock(&c->out.lock);
     c->out.return_socket(c->out.socket_closure);
-    pthread_mutex_lock(&c->iolock);
+    _xcb_lock_out(c);
     c->out.socket_moving = 0;
 
     pthread_cond_broadcast(&c->out.socket_cond);
     c->out.return_socket = 0;
     c->out.socket_closure = 0;
+    _xcb_lock_io(c);
     _xcb_in_replies_done(c);
+    pthread_mutex_unlock(&c->iolock);
 }
 
 /* Public interface */
@@ -112,7 +204,7 @@ uint32_t xcb_get_maximum_request_length(xcb_connection_t *c)
         if(r)
         {
             c->out.maximum_request_length.value = r->maximum_request_length;
-            free(r);
+            _xcb_in_free_reply(c, r);
         }
         else
             c->out.maximum_request_length.value = c->setup->maximum_request_length;
@@ -134,6 +226,7 @@ unsigned int xcb_send_request(xcb_connection_t *c, int flags, struct iovec *vect
     uint64_t request;
     uint32_t prefix[3] = { 0 };
     int veclen = req->count;
+    size_t bytes;
     enum workarounds workaround = WORKAROUND_NONE;
 
     if(c->has_error)
@@ -206,32 +299,54 @@ unsigned int xcb_send_request(xcb_connection_t *c, int flags, struct iovec *vect
         workaround = WORKAROUND_GLX_GET_FB_CONFIGS_BUG;
 
     /* get a sequence number and arrange for delivery. */
-    pthread_mutex_lock(&c->iolock);
-    /* wait for other writing threads to get out of my way. */
-    while(c->out.writing)
-        pthread_cond_wait(&c->out.cond, &c->iolock);
-    get_socket_back(c);
+    _xcb_lock_out(c);
+    /* queue behind another thread's write if there is room, including
+     * for a sync and a BIG-REQUESTS length; otherwise wait for it. Giving
+     * back a taken socket drops the lock, so check again after that. */
+    bytes = request_bytes(vector, veclen) + sizeof(prefix);
+    do
+    {
+        while(c->out.writing && !reserve_queue(c, bytes))
+            pthread_cond_wait(&c->out.cond, &c->out.lock);
+        get_socket_back(c);
+    } while(c->out.writing && !reserve_queue(c, bytes));
 
     request = ++c->out.request;
+    ++c->stats.requests_sent;
     /* send GetInputFocus (sync_req) when 64k-2 requests have been sent without
      * a reply.
      * Also send sync_req (could use NoOp) at 32-bit wrap to avoid having
      * applications see sequence 0 as that is used to indicate
      * an error in sending the request */
-    while((req->isvoid &&
-	c->out.request == c->in.request_expected + (1 << 16) - 1) ||
-       request == 0)
+    while((req->isvoid && need_sync(c)) || request == 0)
     {
         prefix[0] = sync_req.packet;
+        _xcb_lock_io(c);
         _xcb_in_expect_reply(c, request, WORKAROUND_NONE, XCB_REQUEST_DISCARD_REPLY);
-        c->in.request_expected = c->out.request;
+        pthread_mutex_unlock(&c->iolock);
+        set_request_expected(c, c->out.request);
 	request = ++c->out.request;
+        ++c->stats.requests_sent;
+        ++c->stats.syncs_injected;
     }
 
+    /* Only requests that need special handling of their replies touch the
+     * input side; plain requests leave it to the readers. */
     if(workaround != WORKAROUND_NONE || flags != 0)
+    {
+        _xcb_lock_io(c);
         _xcb_in_expect_reply(c, request, workaround, flags);
+        pthread_mutex_unlock(&c->iolock);
+    }
     if(!req->isvoid)
-        c->in.request_expected = c->out.request;
+    {
+        set_request_expected(c, c->out.request);
+        if(c->latency.enabled)
+            _xcb_stats_request_sent(c, req->ext, request, vector, req->count);
+    }
+    TRACE_POINT(c, XCB_TRACE_REQUEST, request, ((uint8_t *) vector[0].iov_base)[0],
+                req->ext ? ((uint8_t *) vector[0].iov_base)[1] : 0,
+                request_bytes(vector, req->count), vector[0].iov_base);
 
     if(prefix[0] || prefix[2])
     {
@@ -251,7 +366,7 @@ unsigned int xcb_send_request(xcb_connection_t *c, int flags, struct iovec *vect
         _xcb_conn_shutdown(c);
         request = 0;
     }
-    pthread_mutex_unlock(&c->iolock);
+    pthread_mutex_unlock(&c->out.lock);
     return request;
 }
 
@@ -260,7 +375,7 @@ int xcb_take_socket(xcb_connection_t *c, void (*return_socket)(void *closure), v
     int ret;
     if(c->has_error)
         return 0;
-    pthread_mutex_lock(&c->iolock);
+    _xcb_lock_out(c);
     get_socket_back(c);
     ret = _xcb_out_flush_to(c, c->out.request);
     if(ret)
@@ -268,11 +383,15 @@ int xcb_take_socket(xcb_connection_t *c, void (*return_socket)(void *closure), v
         c->out.return_socket = return_socket;
         c->out.socket_closure = closure;
         if(flags)
+        {
+            _xcb_lock_io(c);
             _xcb_in_expect_reply(c, c->out.request, WORKAROUND_EXTERNAL_SOCKET_OWNER, flags);
+            pthread_mutex_unlock(&c->iolock);
+        }
         assert(c->out.request == c->out.request_written);
         *sent = c->out.request;
     }
-    pthread_mutex_unlock(&c->iolock);
+    pthread_mutex_unlock(&c->out.lock);
     return ret;
 }
 
@@ -281,10 +400,11 @@ int xcb_writev(xcb_connection_t *c, struct iovec *vector, int count, uint64_t re
     int ret;
     if(c->has_error)
         return 0;
-    pthread_mutex_lock(&c->iolock);
+    _xcb_lock_out(c);
     c->out.request += requests;
+    c->stats.requests_sent += requests;
     ret = _xcb_out_send(c, vector, count);
-    pthread_mutex_unlock(&c->iolock);
+    pthread_mutex_unlock(&c->out.lock);
     return ret;
 }
 
@@ -293,9 +413,9 @@ int xcb_flush(xcb_connection_t *c)
     int ret;
     if(c->has_error)
         return 0;
-    pthread_mutex_lock(&c->iolock);
+    _xcb_lock_out(c);
     ret = _xcb_out_flush_to(c, c->out.request);
-    pthread_mutex_unlock(&c->iolock);
+    pthread_mutex_unlock(&c->out.lock);
     return ret;
 }
 
@@ -303,20 +423,29 @@ int xcb_flush(xcb_connection_t *c)
 
 int _xcb_out_init(_xcb_out *out)
 {
-    if(pthread_cond_init(&out->socket_cond, 0))
+    if(pthread_mutex_init(&out->lock, 0))
+        return 0;
+
+    if(_xcb_conn_cond_init(&out->socket_cond))
         return 0;
     out->return_socket = 0;
     out->socket_closure = 0;
     out->socket_moving = 0;
 
-    if(pthread_cond_init(&out->cond, 0))
+    if(_xcb_conn_cond_init(&out->cond))
         return 0;
     out->writing = 0;
 
     out->queue_len = 0;
+    out->queue_size = out->spare_size = XCB_QUEUE_BUFFER_SIZE;
+    out->queue = malloc(out->queue_size);
+    out->spare = malloc(out->spare_size);
+    if(!out->queue || !out->spare)
+        return 0;
 
     out->request = 0;
     out->request_written = 0;
+    out->request_writing = 0;
 
     if(pthread_mutex_init(&out->reqlenlock, 0))
         return 0;
@@ -327,36 +456,49 @@ int _xcb_out_init(_xcb_out *out)
 
 void _xcb_out_destroy(_xcb_out *out)
 {
+    pthread_mutex_destroy(&out->lock);
     pthread_cond_destroy(&out->cond);
     pthread_mutex_destroy(&out->reqlenlock);
+    free(out->queue);
+    free(out->spare);
 }
 
 int _xcb_out_send(xcb_connection_t *c, struct iovec *vector, int count)
 {
+    /* everything up to here is either written already or in this write;
+     * anything queued while it is in progress waits for the next one */
+    uint64_t request = c->out.request;
     int ret = 1;
     while(ret && count)
-        ret = _xcb_conn_wait(c, &c->out.cond, &vector, &count);
-    c->out.request_written = c->out.request;
+    {
+        if(!c->out.writing)
+            c->out.request_writing = request;
+        ret = _xcb_conn_wait(c, &c->out.cond, &vector, &count, 0);
+    }
+    c->out.request_written = request;
     pthread_cond_broadcast(&c->out.cond);
-    _xcb_in_wake_up_next_reader(c);
     return ret;
 }
 
 int _xcb_out_flush_to(xcb_connection_t *c, uint64_t request)
 {
     assert(XCB_SEQUENCE_COMPARE(request, <=, c->out.request));
-    if(XCB_SEQUENCE_COMPARE(c->out.request_written, >=, request))
-        return 1;
-    if(c->out.queue_len)
+    while(XCB_SEQUENCE_COMPARE(c->out.request_written, <, request))
     {
-        struct iovec vec;
-        vec.iov_base = c->out.queue;
-        vec.iov_len = c->out.queue_len;
-        c->out.queue_len = 0;
-        return _xcb_out_send(c, &vec, 1);
+        if(c->has_error)
+            return 0;
+        /* an empty queue means the request is in another thread's write */
+        if(c->out.queue_len && !c->out.writing)
+        {
+            struct iovec vec;
+            vec.iov_base = c->out.queue;
+            vec.iov_len = c->out.queue_len;
+            ++c->stats.flushes;
+            if(!send_queue(c, &vec, 1))
+                return 0;
+        }
+        else
+            pthread_cond_wait(&c->out.cond, &c->out.lock);
     }
-    while(c->out.writing)
-        pthread_cond_wait(&c->out.cond, &c->iolock);
-    assert(XCB_SEQUENCE_COMPARE(c->out.request_written, >=, request));
     return 1;
 }
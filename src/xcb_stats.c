@@ -0,0 +1,294 @@
+/* Copyright (C) 2001-2008 Bart Massey and Jamey Sharp.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * Except as contained in this notice, the names of the authors or their
+ * institutions shall not be used in advertising or otherwise to promote the
+ * sale, use or other dealings in this Software without prior written
+ * authorization from the authors.
+ */
+
+/* Connection statistics. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "xcb.h"
+#include "xcbext.h"
+#include "xcbint.h"
+
+struct latency_request {
+    uint64_t request;
+    uint64_t sent;
+    struct latency_histogram *histogram;
+    size_t bytes;
+};
+
+struct latency_histogram {
+    struct latency_histogram *next;
+    xcb_request_latency_t data;
+};
+
+static int bucket(uint64_t ns)
+{
+    uint64_t us = ns / 1000;
+    int i = 0;
+    while(us && i < XCB_LATENCY_BUCKETS - 1)
+    {
+        us >>= 1;
+        ++i;
+    }
+    return i;
+}
+
+/* Extension requests are keyed by extension and minor opcode, not by the
+ * major opcode this server happened to assign. */
+static struct latency_histogram *get_histogram(_xcb_latency *l, xcb_extension_t *ext, uint8_t major, uint8_t minor)
+{
+    struct latency_histogram *h;
+    unsigned int key = major;
+    if(ext && ext->global_id)
+        key = (ext->global_id << 8) | minor;
+    else
+        ext = 0;
+
+    h = _xcb_map_get(l->index, key);
+    if(!h)
+    {
+        h = calloc(1, sizeof(*h));
+        if(!h)
+            return 0;
+        if(!_xcb_map_put(l->index, key, h))
+        {
+            free(h);
+            return 0;
+        }
+        h->data.extension = ext ? ext->name : 0;
+        h->data.minor_opcode = ext ? minor : 0;
+        *l->histograms_tail = h;
+        l->histograms_tail = &h->next;
+        ++l->histograms_len;
+    }
+    h->data.major_opcode = major;
+    return h;
+}
+
+static int grow_requests(_xcb_latency *l)
+{
+    int i, size = l->requests_size ? l->requests_size * 2 : 16;
+    struct latency_request *requests = malloc(size * sizeof(*requests));
+    if(!requests)
+        return 0;
+    for(i = 0; i < l->requests_len; ++i)
+        requests[i] = l->requests[(l->requests_head + i) % l->requests_size];
+    free(l->requests);
+    l->requests = requests;
+    l->requests_head = 0;
+    l->requests_size = size;
+    return 1;
+}
+
+/* Public interface */
+
+void xcb_get_statistics(xcb_connection_t *c, xcb_statistics_t *stats)
+{
+    /* a connection that failed later keeps its counters until
+     * xcb_disconnect; only the one that never got made has none */
+    if(c == (xcb_connection_t *) &error_connection)
+    {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+
+    _xcb_lock_out(c);
+    stats->requests_sent = c->stats.requests_sent;
+    stats->bytes_written = c->stats.bytes_written;
+    stats->flushes = c->stats.flushes;
+    stats->writev_calls = c->stats.writev_calls;
+    stats->syncs_injected = c->stats.syncs_injected;
+    stats->out_lock_waits = c->stats.out_lock_waits;
+    stats->out_lock_wait_ns = c->stats.out_lock_wait_ns;
+    pthread_mutex_unlock(&c->out.lock);
+
+    _xcb_lock_io(c);
+    stats->bytes_read = c->stats.bytes_read;
+    stats->round_trips = c->stats.round_trips;
+    stats->events_queued = c->stats.events_queued;
+    stats->event_queue_depth = c->in.ring_tail - c->in.ring_head + c->in.events_len;
+    stats->event_queue_peak = c->stats.event_queue_peak;
+    stats->reply_queue_depth = c->stats.reply_queue_depth;
+    stats->reply_queue_peak = c->stats.reply_queue_peak;
+    stats->iolock_waits = c->stats.iolock_waits;
+    stats->iolock_wait_ns = c->stats.iolock_wait_ns;
+    pthread_mutex_unlock(&c->iolock);
+
+    pthread_mutex_lock(&c->xid.lock);
+    stats->xid_refills = c->stats.xid_refills;
+    pthread_mutex_unlock(&c->xid.lock);
+}
+
+void xcb_get_connect_timings(xcb_connection_t *c, xcb_connect_timings_t *timings)
+{
+    if(c == (xcb_connection_t *) &error_connection)
+        memset(timings, 0, sizeof(*timings));
+    else
+        *timings = c->connect_timings;
+}
+
+int xcb_enable_request_latency(xcb_connection_t *c)
+{
+    if(c->has_error)
+        return 0;
+    /* senders check the flag under out.lock */
+    _xcb_lock_out(c);
+    c->latency.enabled = 1;
+    pthread_mutex_unlock(&c->out.lock);
+    return 1;
+}
+
+int xcb_get_request_latency(xcb_connection_t *c, xcb_request_latency_t *latency, int max)
+{
+    struct latency_histogram *h;
+    int ret, i = 0;
+    if(c->has_error)
+        return 0;
+    pthread_mutex_lock(&c->latency.lock);
+    for(h = c->latency.histograms; h && i < max; h = h->next)
+        latency[i++] = h->data;
+    ret = c->latency.histograms_len;
+    pthread_mutex_unlock(&c->latency.lock);
+    return ret;
+}
+
+/* Private interface */
+
+uint64_t _xcb_stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+uint64_t _xcb_stats_lap(uint64_t *since)
+{
+    uint64_t now = _xcb_stats_now(), ret = now - *since;
+    *since = now;
+    return ret;
+}
+
+/* The counters are updated once the lock is held, so they need no lock
+ * of their own. */
+void _xcb_lock_out(xcb_connection_t *c)
+{
+    uint64_t start;
+    if(!pthread_mutex_trylock(&c->out.lock))
+        return;
+    start = _xcb_stats_now();
+    pthread_mutex_lock(&c->out.lock);
+    ++c->stats.out_lock_waits;
+    c->stats.out_lock_wait_ns += _xcb_stats_now() - start;
+}
+
+void _xcb_lock_io(xcb_connection_t *c)
+{
+    uint64_t start;
+    if(!pthread_mutex_trylock(&c->iolock))
+        return;
+    start = _xcb_stats_now();
+    pthread_mutex_lock(&c->iolock);
+    ++c->stats.iolock_waits;
+    c->stats.iolock_wait_ns += _xcb_stats_now() - start;
+}
+
+int _xcb_stats_init(xcb_connection_t *c)
+{
+    if(pthread_mutex_init(&c->latency.lock, 0))
+        return 0;
+    c->latency.enabled = 0;
+    c->latency.requests = 0;
+    c->latency.requests_head = 0;
+    c->latency.requests_len = 0;
+    c->latency.requests_size = 0;
+    c->latency.index = _xcb_map_new();
+    c->latency.histograms = 0;
+    c->latency.histograms_tail = &c->latency.histograms;
+    c->latency.histograms_len = 0;
+    return c->latency.index != 0;
+}
+
+void _xcb_stats_destroy(xcb_connection_t *c)
+{
+    pthread_mutex_destroy(&c->latency.lock);
+    free(c->latency.requests);
+    _xcb_map_delete(c->latency.index, free);
+}
+
+/* Called with out.lock held, in request order, for requests with replies. */
+void _xcb_stats_request_sent(xcb_connection_t *c, xcb_extension_t *ext, uint64_t request, const struct iovec *vector, int count)
+{
+    _xcb_latency *l = &c->latency;
+    const uint8_t *header = vector[0].iov_base;
+    struct latency_request *cur;
+    size_t bytes = 0;
+    int i;
+
+    for(i = 0; i < count; ++i)
+        bytes += vector[i].iov_len;
+
+    pthread_mutex_lock(&l->lock);
+    if(l->requests_len < l->requests_size || grow_requests(l))
+    {
+        cur = &l->requests[(l->requests_head + l->requests_len) % l->requests_size];
+        cur->histogram = get_histogram(l, ext, header[0], header[1]);
+        if(cur->histogram)
+        {
+            cur->request = request;
+            cur->bytes = bytes;
+            cur->sent = _xcb_stats_now();
+            ++l->requests_len;
+        }
+    }
+    pthread_mutex_unlock(&l->lock);
+}
+
+/* Called with iolock held for each reply or error read. Only the first
+ * response to a request is timed. */
+void _xcb_stats_reply_read(xcb_connection_t *c, uint64_t request, int length)
+{
+    _xcb_latency *l = &c->latency;
+    pthread_mutex_lock(&l->lock);
+    /* requests with no response left are forgotten */
+    while(l->requests_len && l->requests[l->requests_head].request <= request)
+    {
+        struct latency_request *cur = &l->requests[l->requests_head];
+        if(cur->request == request)
+        {
+            uint64_t ns = _xcb_stats_now() - cur->sent;
+            xcb_request_latency_t *data = &cur->histogram->data;
+            ++data->count;
+            data->total_ns += ns;
+            data->bytes_sent += cur->bytes;
+            data->bytes_received += length;
+            ++data->buckets[bucket(ns)];
+        }
+        l->requests_head = (l->requests_head + 1) % l->requests_size;
+        --l->requests_len;
+    }
+    pthread_mutex_unlock(&l->lock);
+}
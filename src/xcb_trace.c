@@ -0,0 +1,171 @@
+/* Copyright (C) 2001-2008 Bart Massey and Jamey Sharp.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * Except as contained in this notice, the names of the authors or their
+ * institutions shall not be used in advertising or otherwise to promote the
+ * sale, use or other dealings in this Software without prior written
+ * authorization from the authors.
+ */
+
+/* Trace hooks, and a writer of Chrome trace-event JSON that uses them. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "xcb.h"
+#include "xcbint.h"
+
+#if XCB_TRACING
+/* One file per process, shared by every connection that writes to it;
+ * stdio locks the stream around each fprintf, and each event is written
+ * with one. */
+static pthread_mutex_t trace_file_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *trace_file;
+static int trace_file_users;
+static int trace_file_connections;
+static int trace_file_started;
+
+static const char trace_file_end[] = "\n]\n";
+
+static const char *const trace_names[] = {
+    "request", "write", "reply", "event", "error", "wait", "wait"
+};
+
+static void write_trace_event(const xcb_trace_record_t *record, void *data)
+{
+    char phase = 'i';
+    if(record->point == XCB_TRACE_BLOCK)
+        phase = 'B';
+    else if(record->point == XCB_TRACE_RESUME)
+        phase = 'E';
+    fprintf(trace_file, ",\n{\"name\":\"%s\",\"ph\":\"%c\",%s\"ts\":%.3f,\"pid\":%ld,\"tid\":%lu,"
+            "\"args\":{\"connection\":%d,\"sequence\":%llu,\"major\":%u,\"minor\":%u,\"size\":%lu}}",
+            trace_names[record->point], phase, phase == 'i' ? "\"s\":\"t\"," : "",
+            record->timestamp / 1000.0, (long) getpid(), (unsigned long) pthread_self(),
+            (int) (long) data, (unsigned long long) record->sequence,
+            record->major_opcode, record->minor_opcode, (unsigned long) record->size);
+}
+
+/* Reopens the file this process has already finished, positioned over the
+ * closing bracket so that new events extend the array. */
+static FILE *reopen_trace_file(const char *name)
+{
+    char end[sizeof(trace_file_end) - 1];
+    FILE *f = fopen(name, "r+");
+    if(!f)
+        return 0;
+    if(fseek(f, -(long) sizeof(end), SEEK_END) || fread(end, 1, sizeof(end), f) != sizeof(end) ||
+       memcmp(end, trace_file_end, sizeof(end)) || fseek(f, -(long) sizeof(end), SEEK_END))
+    {
+        fclose(f);
+        return 0;
+    }
+    return f;
+}
+#endif
+
+/* Public interface */
+
+int xcb_set_trace_hook(xcb_connection_t *c, xcb_trace_func_t hook, void *data)
+{
+#if XCB_TRACING
+    if(c->has_error)
+        return 0;
+    _xcb_lock_out(c);
+    _xcb_lock_io(c);
+    c->trace.hook = hook;
+    c->trace.data = data;
+    pthread_mutex_unlock(&c->iolock);
+    pthread_mutex_unlock(&c->out.lock);
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/* Private interface */
+
+/* Starts writing to $XCB_TRACE_FILE if it is set. The file is opened by
+ * the first connection to want it and finished by the last to go; a later
+ * connection appends to it rather than starting over. */
+void _xcb_trace_init(xcb_connection_t *c)
+{
+#if XCB_TRACING
+    const char *name = getenv("XCB_TRACE_FILE");
+    int connection;
+    if(!name || !*name)
+        return;
+    pthread_mutex_lock(&trace_file_lock);
+    if(!trace_file && trace_file_started)
+        trace_file = reopen_trace_file(name);
+    if(!trace_file)
+    {
+        trace_file = fopen(name, "w");
+        if(trace_file)
+            fprintf(trace_file, "[{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%ld,"
+                    "\"args\":{\"name\":\"libxcb\"}}", (long) getpid());
+        trace_file_started = trace_file != 0;
+    }
+    if(trace_file)
+        ++trace_file_users;
+    connection = ++trace_file_connections;
+    pthread_mutex_unlock(&trace_file_lock);
+    if(trace_file)
+    {
+        c->trace.hook = write_trace_event;
+        c->trace.data = (void *) (long) connection;
+        c->trace.writes_file = 1;
+    }
+#endif
+}
+
+void _xcb_trace_destroy(xcb_connection_t *c)
+{
+#if XCB_TRACING
+    if(!c->trace.writes_file)
+        return;
+    c->trace.hook = 0;
+    c->trace.writes_file = 0;
+    pthread_mutex_lock(&trace_file_lock);
+    if(!--trace_file_users)
+    {
+        fputs(trace_file_end, trace_file);
+        fclose(trace_file);
+        trace_file = 0;
+    }
+    pthread_mutex_unlock(&trace_file_lock);
+#endif
+}
+
+#if XCB_TRACING
+void _xcb_trace_emit(xcb_connection_t *c, xcb_trace_point_t point, uint64_t sequence, uint8_t major_opcode, uint16_t minor_opcode, uint32_t size, const void *data)
+{
+    xcb_trace_record_t record;
+    record.point = point;
+    record.sequence = sequence;
+    record.major_opcode = major_opcode;
+    record.minor_opcode = minor_opcode;
+    record.size = size;
+    record.timestamp = _xcb_stats_now();
+    record.data = data;
+    c->trace.hook(&record, c->trace.data);
+}
+#endif
@@ -414,14 +414,18 @@ xcb_connection_t *xcb_connect_to_display_with_auth_info(const char *displayname,
     char *protocol = NULL;
     xcb_auth_info_t ourauth;
     xcb_connection_t *c;
+    xcb_connect_timings_t timings = { 0 };
+    uint64_t start = _xcb_stats_now(), lap = start;
 
     int parsed = _xcb_parse_display(displayname, &host, &protocol, &display, screenp);
+    timings.parse_display_ns = _xcb_stats_lap(&lap);
     
     if(!parsed) {
         c = (xcb_connection_t *) &error_connection;
         goto out;
     } else
         fd = _xcb_open(host, protocol, display);
+    timings.open_ns = _xcb_stats_lap(&lap);
 
     if(fd == -1) {
         c = (xcb_connection_t *) &error_connection;
@@ -435,15 +439,26 @@ xcb_connection_t *xcb_connect_to_display_with_auth_info(const char *displayname,
 
     if(_xcb_get_auth_info(fd, &ourauth, display))
     {
+        timings.auth_ns = _xcb_stats_lap(&lap);
         c = xcb_connect_to_fd(fd, &ourauth);
         free(ourauth.name);
         free(ourauth.data);
     }
     else
+    {
+        timings.auth_ns = _xcb_stats_lap(&lap);
         c = xcb_connect_to_fd(fd, 0);
+    }
 
 out:
     free(host);
     free(protocol);
+    if(!c->has_error)
+    {
+        c->connect_timings.parse_display_ns = timings.parse_display_ns;
+        c->connect_timings.open_ns = timings.open_ns;
+        c->connect_timings.auth_ns = timings.auth_ns;
+        c->connect_timings.total_ns = _xcb_stats_now() - start;
+    }
     return c;
 }
@@ -68,8 +68,9 @@ uint32_t xcb_generate_id(xcb_connection_t *c)
             assert(range->count > 0 && range->start_id > 0);
             c->xid.last = range->start_id;
             c->xid.max = range->start_id + (range->count - 1) * c->xid.inc;
-            free(range);
+            _xcb_in_free_reply(c, range);
         }
+        ++c->stats.xid_refills;
     } else {
         c->xid.last += c->xid.inc;
     }
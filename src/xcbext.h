@@ -82,6 +82,13 @@ int xcb_writev(xcb_connection_t *c, struct iovec *vector, int count, uint64_t re
 void *xcb_wait_for_reply(xcb_connection_t *c, unsigned int request, xcb_generic_error_t **e);
 int xcb_poll_for_reply(xcb_connection_t *c, unsigned int request, void **reply, xcb_generic_error_t **error);
 
+/* Like xcb_wait_for_reply, but gives up after timeout milliseconds
+ * (negative means never). Returns 0 if it gave up, leaving the reply to
+ * be collected later, or 1 with *reply and *error set as by
+ * xcb_poll_for_reply. Writing the request out is not bounded by the
+ * timeout. */
+int xcb_wait_for_reply_timeout(xcb_connection_t *c, unsigned int request, int timeout, void **reply, xcb_generic_error_t **error);
+
 
 /* xcb_util.c */
 
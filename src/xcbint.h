@@ -34,6 +34,10 @@
 #include "config.h"
 #endif
 
+#if XCB_TRACING
+#include <stdio.h>
+#endif
+
 #ifdef GCC_HAS_VISIBILITY
 #pragma GCC visibility push(hidden)
 #endif
@@ -66,6 +70,9 @@ enum lazy_reply_tag
 
 #define container_of(pointer,type,member) ((type *)(((char *)(pointer)) - offsetof(type, member)))
 
+/* Must be a power of two. */
+#define XCB_EVENT_RING_SIZE 1024
+
 /* xcb_list.c */
 
 typedef void (*xcb_list_free_func_t)(void *);
@@ -75,12 +82,34 @@ typedef struct _xcb_map _xcb_map;
 _xcb_map *_xcb_map_new(void);
 void _xcb_map_delete(_xcb_map *q, xcb_list_free_func_t do_free);
 int _xcb_map_put(_xcb_map *q, unsigned int key, void *data);
+void *_xcb_map_get(_xcb_map *q, unsigned int key);
 void *_xcb_map_remove(_xcb_map *q, unsigned int key);
 
+typedef struct _xcb_freelist {
+    void *head;
+    size_t size;
+    int count;
+    int max;
+} _xcb_freelist;
+
+void _xcb_freelist_init(_xcb_freelist *list, size_t size, int max);
+void _xcb_freelist_destroy(_xcb_freelist *list);
+void *_xcb_freelist_get(_xcb_freelist *list);
+void _xcb_freelist_put(_xcb_freelist *list, void *obj);
+
 
 /* xcb_out.c */
 
+/* The output queue starts out XCB_QUEUE_BUFFER_SIZE bytes long. While a
+ * write is in progress, it grows to hold what senders queue behind the
+ * write, up to this size, and shrinks back once a write finishes with no
+ * more than the initial size queued behind it. */
+#define XCB_QUEUE_BUFFER_MAX (16 * XCB_QUEUE_BUFFER_SIZE)
+
 typedef struct _xcb_out {
+    /* Guards everything below up to reqlenlock. Taken before iolock when
+     * both are needed. */
+    pthread_mutex_t lock;
     pthread_cond_t cond;
     int writing;
 
@@ -89,11 +118,20 @@ typedef struct _xcb_out {
     void *socket_closure;
     int socket_moving;
 
-    char queue[XCB_QUEUE_BUFFER_SIZE];
+    /* Double-buffered: a flush swaps the queue for the spare buffer, so
+     * senders can keep queueing whenever _xcb_conn_wait drops the lock to
+     * poll, and the written buffer becomes the spare. Only one buffer is
+     * ever being written, so the spare is there whenever nobody is
+     * writing. */
+    char *queue;
     int queue_len;
+    int queue_size;
+    char *spare;
+    int spare_size;
 
     uint64_t request;
     uint64_t request_written;
+    uint64_t request_writing; /* the last request in the write in progress */
 
     pthread_mutex_t reqlenlock;
     enum lazy_reply_tag maximum_request_length_tag;
@@ -115,10 +153,16 @@ int _xcb_out_flush_to(xcb_connection_t *c, uint64_t request);
 typedef struct _xcb_in {
     pthread_cond_t event_cond;
     int reading;
+    int has_reader_thread;
+    pthread_t reader_thread;
 
-    char queue[4096];
+    char queue[XCB_IN_QUEUE_BUFFER_SIZE];
+    int queue_head;
     int queue_len;
 
+    /* request_expected is updated by both senders and readers, so it has
+     * a lock of its own. Never take another lock while holding it. */
+    pthread_mutex_t expected_lock;
     uint64_t request_expected;
     uint64_t request_read;
     uint64_t request_completed;
@@ -126,22 +170,50 @@ typedef struct _xcb_in {
     struct reply_list **current_reply_tail;
 
     _xcb_map *replies;
+    /* Queued events. The ring can be emptied without taking iolock; the
+     * list holds events that arrived while the ring was full, which are
+     * all newer than those in the ring. */
+    xcb_generic_event_t *volatile ring[XCB_EVENT_RING_SIZE];
+    volatile unsigned int ring_head;
+    volatile unsigned int ring_tail;
     struct event_list *events;
     struct event_list **events_tail;
-    struct reader_list *readers;
+    int events_len;
+    int event_fd[2];
+    int event_fd_ready;
+    struct event_coalescing *coalescing;
+    struct event_handler *handlers;
+    xcb_alloc_func_t alloc;
+    xcb_free_func_t release;
+    void *alloc_data;
+    _xcb_map *reply_buffers;
+    _xcb_map *ge_handlers;
+    struct reader_list **readers;
+    int readers_len;
+    int readers_size;
 
     struct pending_reply *pending_replies;
     struct pending_reply **pending_replies_tail;
+    _xcb_map *pending_index;
+    _xcb_map *discards;
+    int discards_len;
+
+    _xcb_freelist nodes;
+    _xcb_freelist pending;
+    _xcb_freelist event_buffers;
 } _xcb_in;
 
 int _xcb_in_init(_xcb_in *in);
 void _xcb_in_destroy(_xcb_in *in);
 
+void _xcb_in_free_reply(xcb_connection_t *c, void *reply);
 void _xcb_in_wake_up_next_reader(xcb_connection_t *c);
 
 int _xcb_in_expect_reply(xcb_connection_t *c, uint64_t request, enum workarounds workaround, int flags);
 void _xcb_in_replies_done(xcb_connection_t *c);
 
+int _xcb_in_set_ge_event_handler(xcb_connection_t *c, uint8_t extension, uint16_t event_type, xcb_event_handler_t handler, void *data);
+
 int _xcb_in_read(xcb_connection_t *c);
 int _xcb_in_read_block(xcb_connection_t *c, void *buf, int nread);
 
@@ -172,6 +244,87 @@ int _xcb_ext_init(xcb_connection_t *c);
 void _xcb_ext_destroy(xcb_connection_t *c);
 
 
+/* xcb_stats.c */
+
+typedef struct _xcb_latency {
+    /* Senders and readers both use this; never take another lock while
+     * holding it. */
+    pthread_mutex_t lock;
+    int enabled;
+    /* requests awaiting their first reply, oldest first */
+    struct latency_request *requests;
+    int requests_head;
+    int requests_len;
+    int requests_size;
+    /* one histogram per request type, in the order first sent */
+    _xcb_map *index;
+    struct latency_histogram *histograms;
+    struct latency_histogram **histograms_tail;
+    int histograms_len;
+} _xcb_latency;
+
+/* CLOCK_MONOTONIC in nanoseconds */
+uint64_t _xcb_stats_now(void);
+
+/* The time since *since, which is then moved up to now. */
+uint64_t _xcb_stats_lap(uint64_t *since);
+
+/* Take out.lock or iolock, counting the wait if another thread holds it. */
+void _xcb_lock_out(xcb_connection_t *c);
+void _xcb_lock_io(xcb_connection_t *c);
+
+int _xcb_stats_init(xcb_connection_t *c);
+void _xcb_stats_destroy(xcb_connection_t *c);
+
+void _xcb_stats_request_sent(xcb_connection_t *c, xcb_extension_t *ext, uint64_t request, const struct iovec *vector, int count);
+void _xcb_stats_reply_read(xcb_connection_t *c, uint64_t request, int length);
+
+
+/* xcb_trace.c */
+
+#if XCB_TRACING
+typedef struct _xcb_trace {
+    /* Set with both out.lock and iolock held, so either one suffices to
+     * read it. */
+    xcb_trace_func_t hook;
+    void *data;
+    int writes_file; /* holds a reference to the $XCB_TRACE_FILE writer */
+} _xcb_trace;
+
+void _xcb_trace_emit(xcb_connection_t *c, xcb_trace_point_t point, uint64_t sequence, uint8_t major_opcode, uint16_t minor_opcode, uint32_t size, const void *data);
+
+/* Arguments are only evaluated when a hook is set. */
+#define TRACE_POINT(c, point, sequence, major_opcode, minor_opcode, size, data) \
+    do { \
+        if((c)->trace.hook) \
+            _xcb_trace_emit(c, point, sequence, major_opcode, minor_opcode, size, data); \
+    } while(0)
+#else
+#define TRACE_POINT(c, point, sequence, major_opcode, minor_opcode, size, data) do { } while(0)
+#endif
+
+void _xcb_trace_init(xcb_connection_t *c);
+void _xcb_trace_destroy(xcb_connection_t *c);
+
+
+/* xcb_capture.c */
+
+void _xcb_capture_init(xcb_connection_t *c);
+void _xcb_capture_destroy(xcb_connection_t *c);
+
+#if XCB_TRACING
+void _xcb_capture(xcb_connection_t *c, int direction, uint64_t sequence, const struct iovec *vector, int count, size_t len);
+
+#define CAPTURE(c, direction, sequence, vector, count, len) \
+    do { \
+        if((c)->capture) \
+            _xcb_capture(c, direction, sequence, vector, count, len); \
+    } while(0)
+#else
+#define CAPTURE(c, direction, sequence, vector, count, len) do { } while(0)
+#endif
+
+
 /* xcb_conn.c */
 
 extern const int error_connection;
@@ -184,17 +337,31 @@ struct xcb_connection_t {
     int fd;
 
     /* I/O data */
-    pthread_mutex_t iolock;
+    pthread_mutex_t iolock; /* input only; output has out.lock */
     _xcb_in in;
     _xcb_out out;
 
     /* misc data */
     _xcb_ext ext;
     _xcb_xid xid;
+
+    /* Each counter is only updated under the lock that already guards
+     * what it counts: out.lock for output, iolock for input, and xid.lock
+     * for XID ranges. The depths are filled in on demand. */
+    xcb_statistics_t stats;
+    xcb_connect_timings_t connect_timings; /* written only while connecting */
+    _xcb_latency latency;
+#if XCB_TRACING
+    _xcb_trace trace;
+    FILE *capture; /* $XCB_CAPTURE_FILE, or null */
+#endif
 };
 
 void _xcb_conn_shutdown(xcb_connection_t *c);
-int _xcb_conn_wait(xcb_connection_t *c, pthread_cond_t *cond, struct iovec **vector, int *count);
+int _xcb_conn_cond_init(pthread_cond_t *cond);
+void _xcb_conn_deadline(struct timespec *deadline, int timeout);
+int _xcb_conn_expired(const struct timespec *deadline);
+int _xcb_conn_wait(xcb_connection_t *c, pthread_cond_t *cond, struct iovec **vector, int *count, const struct timespec *deadline);
 
 
 /* xcb_auth.c */
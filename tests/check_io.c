@@ -0,0 +1,1442 @@
+#include <check.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/time.h>
+#include "check_suites.h"
+#include "xcb.h"
+#include "xcbext.h"
+#include "bigreq.h"
+#include "xc_misc.h"
+#include "xcb_capture.h"
+#include "mock_server.h"
+
+/* Connection I/O tests against the in-process mock server {{{ */
+
+static mock_server_t *server;
+static xcb_connection_t *c;
+
+static void io_connect(void)
+{
+	server = mock_server_new();
+	fail_unless(server != 0, "cannot create the mock server");
+	mock_server_add_extension(server, "MOCK-EXTENSION", 150, 100, 200);
+}
+
+static void io_disconnect(void)
+{
+	fail_unless(!xcb_connection_has_error(c), "connection failed");
+	xcb_disconnect(c);
+	mock_server_free(server);
+	c = 0;
+	server = 0;
+}
+
+START_TEST(io_setup)
+{
+	const xcb_setup_t *setup;
+	xcb_screen_t *screen;
+
+	io_connect();
+	c = mock_server_connect(server);
+	fail_unless(!xcb_connection_has_error(c), "cannot connect to the mock server");
+	setup = xcb_get_setup(c);
+	fail_unless(setup->roots_len == 1, "expected one screen, got %d", setup->roots_len);
+	screen = xcb_setup_roots_iterator(setup).data;
+	fail_unless(screen->root == MOCK_SERVER_ROOT, "unexpected root 0x%x", screen->root);
+	fail_unless(screen->root_visual == MOCK_SERVER_ROOT_VISUAL, "unexpected root visual 0x%x", screen->root_visual);
+	fail_unless(screen->width_in_pixels == 1024 && screen->height_in_pixels == 768, "unexpected screen size");
+	fail_unless(xcb_generate_id(c) == 0x00400000, "unexpected first XID");
+	io_disconnect();
+}
+END_TEST
+
+START_TEST(io_connect_timings)
+{
+	xcb_connect_timings_t timings;
+	int stdin_open = fcntl(0, F_GETFD) != -1;
+
+	io_connect();
+	c = mock_server_connect(server);
+	xcb_get_connect_timings(c, &timings);
+	fail_unless(!timings.parse_display_ns && !timings.open_ns && !timings.auth_ns,
+		"xcb_connect_to_fd timed steps it did not take");
+	fail_unless(timings.read_setup_ns > 0, "reading the setup took no time");
+	fail_unless(timings.total_ns >= timings.write_setup_ns + timings.read_setup_ns + timings.ext_init_ns + timings.xid_init_ns,
+		"steps took longer than the whole");
+	io_disconnect();
+
+	xcb_get_connect_timings(c = xcb_connect_to_fd(-1, 0), &timings);
+	fail_unless(xcb_connection_has_error(c) && !timings.total_ns, "failed connection has timings");
+	fail_unless(!stdin_open || fcntl(0, F_GETFD) != -1, "failed connection closed fd 0");
+}
+END_TEST
+
+START_TEST(io_statistics_after_error)
+{
+	static xcb_point_t points[70000];
+	xcb_connect_timings_t timings;
+	xcb_statistics_t before, after;
+
+	io_connect();
+	c = mock_server_connect(server);
+	free(xcb_get_input_focus_reply(c, xcb_get_input_focus(c), 0));
+	xcb_get_statistics(c, &before);
+	fail_unless(before.round_trips == 1 && before.requests_sent >= 1, "no round trip counted");
+
+	/* too long without BIG-REQUESTS, which the mock server lacks */
+	xcb_poly_point(c, XCB_COORD_MODE_ORIGIN, MOCK_SERVER_ROOT, 0, sizeof(points) / sizeof(*points), points);
+	fail_unless(xcb_connection_has_error(c), "overlong request accepted");
+	xcb_get_statistics(c, &after);
+	fail_unless(after.round_trips >= before.round_trips && after.requests_sent >= before.requests_sent &&
+		after.bytes_read >= before.bytes_read, "counters lost when the connection failed");
+	xcb_get_connect_timings(c, &timings);
+	fail_unless(timings.read_setup_ns > 0 && timings.total_ns > 0, "timings lost when the connection failed");
+
+	xcb_disconnect(c);
+	mock_server_free(server);
+	c = 0;
+	server = 0;
+}
+END_TEST
+
+START_TEST(io_round_trip)
+{
+	xcb_get_input_focus_reply_t *focus;
+	xcb_intern_atom_reply_t *first, *again, *missing;
+	xcb_intern_atom_cookie_t cookies[3];
+
+	io_connect();
+	c = mock_server_connect(server);
+	focus = xcb_get_input_focus_reply(c, xcb_get_input_focus(c), 0);
+	fail_unless(focus != 0, "no GetInputFocus reply");
+	fail_unless(focus->focus == MOCK_SERVER_ROOT, "unexpected focus 0x%x", focus->focus);
+	free(focus);
+
+	cookies[0] = xcb_intern_atom(c, 0, strlen("MOCK_ATOM"), "MOCK_ATOM");
+	cookies[1] = xcb_intern_atom(c, 1, strlen("MOCK_ATOM"), "MOCK_ATOM");
+	cookies[2] = xcb_intern_atom(c, 1, strlen("MOCK_MISSING"), "MOCK_MISSING");
+	first = xcb_intern_atom_reply(c, cookies[0], 0);
+	again = xcb_intern_atom_reply(c, cookies[1], 0);
+	missing = xcb_intern_atom_reply(c, cookies[2], 0);
+	fail_unless(first && again && missing, "missing InternAtom reply");
+	fail_unless(first->atom != XCB_ATOM_NONE, "atom not interned");
+	fail_unless(again->atom == first->atom, "atom interned twice: %d and %d", first->atom, again->atom);
+	fail_unless(missing->atom == XCB_ATOM_NONE, "only_if_exists created atom %d", missing->atom);
+	free(first);
+	free(again);
+	free(missing);
+	fail_unless(mock_server_requests(server, XCB_INTERN_ATOM) == 3, "server read %d InternAtom requests",
+		mock_server_requests(server, XCB_INTERN_ATOM));
+	io_disconnect();
+}
+END_TEST
+
+START_TEST(io_extension)
+{
+	xcb_extension_t present = { "MOCK-EXTENSION" };
+	xcb_extension_t absent = { "MOCK-ABSENT" };
+	const xcb_query_extension_reply_t *reply;
+
+	io_connect();
+	c = mock_server_connect(server);
+	xcb_prefetch_extension_data(c, &present);
+	xcb_prefetch_extension_data(c, &absent);
+	reply = xcb_get_extension_data(c, &present);
+	fail_unless(reply && reply->present, "extension not found");
+	fail_unless(reply->major_opcode == 150 && reply->first_event == 100 && reply->first_error == 200,
+		"unexpected extension data %d/%d/%d", reply->major_opcode, reply->first_event, reply->first_error);
+	reply = xcb_get_extension_data(c, &absent);
+	fail_unless(reply && !reply->present, "absent extension found");
+	fail_unless(mock_server_requests(server, XCB_QUERY_EXTENSION) == 2, "extension queried %d times",
+		mock_server_requests(server, XCB_QUERY_EXTENSION));
+	io_disconnect();
+}
+END_TEST
+
+START_TEST(io_latency)
+{
+	struct timeval start, end;
+	long usec;
+
+	io_connect();
+	c = mock_server_connect(server);
+	mock_server_set_latency(server, 20000);
+	gettimeofday(&start, 0);
+	free(xcb_get_input_focus_reply(c, xcb_get_input_focus(c), 0));
+	gettimeofday(&end, 0);
+	usec = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
+	fail_unless(usec >= 20000, "round trip took only %ld us", usec);
+	mock_server_set_latency(server, 0);
+	io_disconnect();
+}
+END_TEST
+
+static long elapsed_usec(const struct timeval *start)
+{
+	struct timeval end;
+	gettimeofday(&end, 0);
+	return (end.tv_sec - start->tv_sec) * 1000000 + (end.tv_usec - start->tv_usec);
+}
+
+START_TEST(io_timeouts)
+{
+	xcb_get_input_focus_cookie_t first, second, discarded;
+	xcb_get_input_focus_reply_t *focus;
+	xcb_generic_event_t *event;
+	xcb_generic_error_t *error;
+	struct timeval start;
+	void *reply;
+
+	io_connect();
+	c = mock_server_connect(server);
+	mock_server_set_latency(server, 200000);
+
+	/* a reply wait that times out leaves the reply to be collected later,
+	 * even after a later request's reply has been waited for */
+	first = xcb_get_input_focus(c);
+	gettimeofday(&start, 0);
+	fail_unless(!xcb_wait_for_reply_timeout(c, first.sequence, 20, &reply, &error), "reply wait did not time out");
+	fail_unless(elapsed_usec(&start) >= 20000, "reply wait timed out after %ld us", elapsed_usec(&start));
+	fail_unless(!reply && !error, "timed out reply wait returned a result");
+	second = xcb_get_input_focus(c);
+	focus = xcb_get_input_focus_reply(c, second, 0);
+	fail_unless(focus && focus->focus == MOCK_SERVER_ROOT, "no reply after a timed out wait");
+	free(focus);
+	focus = xcb_get_input_focus_reply(c, first, 0);
+	fail_unless(focus && focus->focus == MOCK_SERVER_ROOT, "timed out reply lost");
+	free(focus);
+
+	/* or to be discarded */
+	discarded = xcb_get_input_focus(c);
+	fail_unless(!xcb_wait_for_reply_timeout(c, discarded.sequence, 20, &reply, &error), "reply wait did not time out");
+	xcb_discard_reply(c, discarded.sequence);
+	mock_server_set_latency(server, 0);
+	focus = xcb_get_input_focus_reply(c, xcb_get_input_focus(c), 0);
+	fail_unless(focus && focus->focus == MOCK_SERVER_ROOT, "no reply after discarding a timed out one");
+	free(focus);
+	fail_unless(!xcb_poll_for_event(c), "discarded reply showed up as an event");
+
+	/* event waits */
+	fail_unless(!xcb_wait_for_event_timeout(c, 0), "event with none sent");
+	gettimeofday(&start, 0);
+	fail_unless(!xcb_wait_for_event_timeout(c, 20), "event with none sent");
+	fail_unless(elapsed_usec(&start) >= 20000, "event wait timed out after %ld us", elapsed_usec(&start));
+	fail_unless(!xcb_connection_has_error(c), "event wait timing out broke the connection");
+	mock_server_flood(server, XCB_MOTION_NOTIFY, 1);
+	event = xcb_wait_for_event_timeout(c, 10000);
+	fail_unless(event && event->response_type == XCB_MOTION_NOTIFY, "event lost after a timed out wait");
+	free(event);
+	io_disconnect();
+}
+END_TEST
+
+START_TEST(io_event_order)
+{
+	/* more events than fit in the default input ring */
+	const unsigned int count = 3 * 65536 / 32;
+	unsigned int i;
+
+	io_connect();
+	c = mock_server_connect(server);
+	xcb_flush(c);
+	mock_server_flood(server, XCB_MOTION_NOTIFY, count);
+	for(i = 0; i < count; ++i)
+	{
+		xcb_generic_event_t *event = xcb_wait_for_event(c);
+		fail_unless(event != 0, "connection lost after %u events", i);
+		fail_unless(event->response_type == XCB_MOTION_NOTIFY, "unexpected event type %d", event->response_type);
+		fail_unless(event->pad[0] == i, "event %u arrived as %u", event->pad[0], i);
+		free(event);
+	}
+	io_disconnect();
+}
+END_TEST
+
+/* more than fit in the event ring, so the rest go on the overflow list */
+#define BATCH_FLOOD 1500
+
+START_TEST(io_event_batches)
+{
+	static xcb_generic_event_t *events[BATCH_FLOOD];
+	uint32_t next = 0;
+	int i, n;
+
+	io_connect();
+	c = mock_server_connect(server);
+	mock_server_flood(server, XCB_MOTION_NOTIFY, BATCH_FLOOD);
+	n = xcb_wait_for_events(c, events, 1);
+	fail_unless(n == 1 && events[0]->pad[0] == next++, "first event missing");
+	free(events[0]);
+	/* the server reads this only after sending the whole flood */
+	free(xcb_get_input_focus_reply(c, xcb_get_input_focus(c), 0));
+
+	n = xcb_poll_for_events(c, events, 10);
+	fail_unless(n == 10, "%d of 10 events in a short batch", n);
+	n += xcb_wait_for_events(c, events + n, BATCH_FLOOD);
+	fail_unless(n == BATCH_FLOOD - 1, "%d of %d events in batches", n, BATCH_FLOOD - 1);
+	for(i = 0; i < n; ++i)
+	{
+		fail_unless(events[i]->response_type == XCB_MOTION_NOTIFY && events[i]->pad[0] == next,
+			"event %u arrived as %u", next, events[i]->pad[0]);
+		++next;
+		free(events[i]);
+	}
+	fail_unless(!xcb_poll_for_events(c, events, BATCH_FLOOD), "events left after a full batch");
+	io_disconnect();
+}
+END_TEST
+
+START_TEST(io_queued_events)
+{
+	xcb_generic_event_t peeked, *event;
+	struct pollfd pfd;
+	unsigned int i;
+
+	io_connect();
+	c = mock_server_connect(server);
+	fail_unless(!xcb_peek_event(c, &peeked), "peeked at an empty queue");
+	/* the server sends the flood before it reads the request */
+	mock_server_flood(server, XCB_MOTION_NOTIFY, 3);
+	free(xcb_get_input_focus_reply(c, xcb_get_input_focus(c), 0));
+
+	/* peeking leaves the event for the next poll */
+	for(i = 0; i < 3; ++i)
+	{
+		fail_unless(xcb_peek_event(c, &peeked), "nothing to peek at for event %u", i);
+		fail_unless(peeked.response_type == XCB_MOTION_NOTIFY && peeked.pad[0] == i,
+			"peeked at event %u as %u", peeked.pad[0], i);
+		fail_unless(xcb_peek_event(c, &peeked) && peeked.pad[0] == i, "peeking removed event %u", i);
+		event = xcb_poll_for_queued_event(c);
+		fail_unless(event != 0, "queued event %u missing", i);
+		fail_unless(!memcmp(event, &peeked, sizeof(peeked)), "peeked event %u differs from the one returned", i);
+		free(event);
+	}
+
+	/* nor does a queued poll read what has arrived since */
+	mock_server_flood(server, XCB_MOTION_NOTIFY, 1);
+	pfd.fd = xcb_get_file_descriptor(c);
+	pfd.events = POLLIN;
+	fail_unless(poll(&pfd, 1, 1000) == 1, "flood did not arrive");
+	fail_unless(!xcb_poll_for_queued_event(c), "xcb_poll_for_queued_event read the socket");
+	fail_unless(!xcb_peek_event(c, &peeked), "xcb_peek_event read the socket");
+	fail_unless(poll(&pfd, 1, 0) == 1, "event read from the socket");
+	event = xcb_poll_for_event(c);
+	fail_unless(event && event->response_type == XCB_MOTION_NOTIFY && event->pad[0] == 0,
+		"xcb_poll_for_event did not read the event");
+	free(event);
+	io_disconnect();
+}
+END_TEST
+
+/* Sends three MotionNotify events ahead of each GetInputFocus reply. */
+static int motion_before_focus_handler(mock_server_t *server, const uint8_t *request, size_t length, uint16_t sequence, void *data)
+{
+	uint8_t event[32] = { XCB_MOTION_NOTIFY };
+	int i;
+	if(request[0] != XCB_GET_INPUT_FOCUS)
+		return 0;
+	*(uint16_t *) (event + 2) = sequence - 1;
+	for(i = 0; i < 3; ++i)
+		if(!mock_server_send(server, event, sizeof(event)))
+			return 0;
+	return 0;
+}
+
+static int readable(int fd)
+{
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN);
+}
+
+START_TEST(io_event_fd)
+{
+	xcb_generic_event_t *event;
+	int fd, i;
+
+	io_connect();
+	mock_server_set_handler(server, motion_before_focus_handler, 0);
+	c = mock_server_connect(server);
+	fd = xcb_get_event_fd(c);
+	fail_unless(fd >= 0, "no event fd");
+	fail_unless(xcb_get_event_fd(c) == fd, "event fd changed");
+	fail_unless(!readable(fd), "event fd readable with no events queued");
+
+	/* the events are read off the socket while waiting for the reply */
+	free(xcb_get_input_focus_reply(c, xcb_get_input_focus(c), 0));
+	fail_unless(readable(fd), "event fd not readable with events queued");
+	for(i = 0; i < 3; ++i)
+	{
+		fail_unless(readable(fd), "event fd not readable with %d events left", 3 - i);
+		event = xcb_poll_for_event(c);
+		fail_unless(event && event->response_type == XCB_MOTION_NOTIFY, "event %d missing", i);
+		free(event);
+	}
+	fail_unless(!readable(fd), "event fd still readable after draining the queue");
+	fail_unless(!xcb_poll_for_event(c), "unexpected event");
+	io_disconnect();
+}
+END_TEST
+
+/* Events sent ahead of each GetInputFocus reply by configure_handler: a
+ * ConfigureNotify for the given window, with x set to its place in the
+ * script; the same from SendEvent; or a MotionNotify. */
+#define MOTION 0
+#define SYNTHETIC 0x80000000
+static const uint32_t configure_script[] = { 1, MOTION, 1 | SYNTHETIC, 2, 1, 3, 2, 1 };
+#define CONFIGURE_SCRIPT_LEN (sizeof(configure_script) / sizeof(*configure_script))
+
+static int configure_handler(mock_server_t *server, const uint8_t *request, size_t length, uint16_t sequence, void *data)
+{
+	unsigned int i;
+	if(request[0] != XCB_GET_INPUT_FOCUS)
+		return 0;
+	for(i = 0; i < CONFIGURE_SCRIPT_LEN; ++i)
+	{
+		/* events are padded to 32 bytes on the wire */
+		union {
+			xcb_configure_notify_event_t configure;
+			uint8_t packet[32];
+		} event;
+		memset(&event, 0, sizeof(event));
+		if(configure_script[i] == MOTION)
+			event.configure.response_type = XCB_MOTION_NOTIFY;
+		else
+			event.configure.response_type = XCB_CONFIGURE_NOTIFY | (configure_script[i] & SYNTHETIC ? 0x80 : 0);
+		event.configure.sequence = sequence - 1;
+		event.configure.event = event.configure.window = configure_script[i] & ~SYNTHETIC;
+		event.configure.x = i;
+		if(!mock_server_send(server, event.packet, sizeof(event.packet)))
+			return 0;
+	}
+	return 0;
+}
+
+/* Keeps the newest x and counts the merged events in y. */
+static int merge_configure(xcb_generic_event_t *queued, const xcb_generic_event_t *event, void *data)
+{
+	xcb_configure_notify_event_t *older = (xcb_configure_notify_event_t *) queued;
+	older->x = ((const xcb_configure_notify_event_t *) event)->x;
+	++older->y;
+	++*(int *) data;
+	return 1;
+}
+
+/* Collects what configure_handler sent, as response type, window, x and
+ * y, and checks it against the expected events. */
+static void check_configure_events(const char *policy, const int (*expected)[4], int count)
+{
+	xcb_generic_event_t *event;
+	int i = 0;
+	free(xcb_get_input_focus_reply(c, xcb_get_input_focus(c), 0));
+	while((event = xcb_poll_for_event(c)))
+	{
+		xcb_configure_notify_event_t *configure = (xcb_configure_notify_event_t *) event;
+		fail_unless(i < count, "%s: unexpected event %d", policy, i);
+		fail_unless(event->response_type == expected[i][0], "%s: event %d has type %d, not %d",
+			policy, i, event->response_type, expected[i][0]);
+		if(event->response_type != XCB_MOTION_NOTIFY)
+			fail_unless(configure->window == expected[i][1] && configure->x == expected[i][2] && configure->y == expected[i][3],
+				"%s: event %d is window %u x %d y %d, not window %d x %d y %d", policy, i,
+				configure->window, configure->x, configure->y, expected[i][1], expected[i][2], expected[i][3]);
+		free(event);
+		++i;
+	}
+	fail_unless(i == count, "%s: %d events, not %d", policy, i, count);
+}
+
+START_TEST(io_coalescing)
+{
+	/* the newest event for each window is kept where it arrived */
+	static const int replaced[][4] = {
+		{ XCB_MOTION_NOTIFY }, { XCB_CONFIGURE_NOTIFY | 0x80, 1, 2, 0 },
+		{ XCB_CONFIGURE_NOTIFY, 3, 5, 0 }, { XCB_CONFIGURE_NOTIFY, 2, 6, 0 }, { XCB_CONFIGURE_NOTIFY, 1, 7, 0 },
+	};
+	/* newer events are folded into the oldest for each window */
+	static const int merged[][4] = {
+		{ XCB_CONFIGURE_NOTIFY, 1, 7, 2 }, { XCB_MOTION_NOTIFY }, { XCB_CONFIGURE_NOTIFY | 0x80, 1, 2, 0 },
+		{ XCB_CONFIGURE_NOTIFY, 2, 6, 1 }, { XCB_CONFIGURE_NOTIFY, 3, 5, 0 },
+	};
+	xcb_generic_event_t *event;
+	int merges = 0;
+
+	io_connect();
+	mock_server_set_handler(server, configure_handler, 0);
+	c = mock_server_connect(server);
+
+	fail_unless(xcb_set_event_coalescing(c, XCB_CONFIGURE_NOTIFY, XCB_COALESCE_REPLACE, 8, 0, 0),
+		"cannot set XCB_COALESCE_REPLACE");
+	check_configure_events("replace", replaced, sizeof(replaced) / sizeof(*replaced));
+	/* events taken by the application are not coalesced into */
+	check_configure_events("replace again", replaced, sizeof(replaced) / sizeof(*replaced));
+
+	fail_unless(xcb_set_event_coalescing(c, XCB_CONFIGURE_NOTIFY, XCB_COALESCE_MERGE, 8, merge_configure, &merges),
+		"cannot set XCB_COALESCE_MERGE");
+	check_configure_events("merge", merged, sizeof(merged) / sizeof(*merged));
+	fail_unless(merges == 3, "%d merges, not 3", merges);
+
+	fail_unless(xcb_set_event_coalescing(c, XCB_CONFIGURE_NOTIFY, XCB_COALESCE_NONE, 0, 0, 0),
+		"cannot turn coalescing off");
+	free(xcb_get_input_focus_reply(c, xcb_get_input_focus(c), 0));
+	for(merges = 0; (event = xcb_poll_for_event(c)); ++merges)
+		free(event);
+	fail_unless(merges == CONFIGURE_SCRIPT_LEN, "%d events without coalescing, not %d", merges, (int) CONFIGURE_SCRIPT_LEN);
+	io_disconnect();
+}
+END_TEST
+
+/* Fails FreePixmap with BadPixmap for even pixmaps. The last request
+ * then succeeds, so its completion can only be proven by a sync. */
+static int free_pixmap_handler(mock_server_t *server, const uint8_t *request, size_t length, uint16_t sequence, void *data)
+{
+	xcb_generic_error_t error;
+	if(request[0] != XCB_FREE_PIXMAP)
+		return 0;
+	if(*(const uint32_t *) (request + 4) & 1)
+		return 1;
+	memset(&error, 0, sizeof(error));
+	error.error_code = XCB_PIXMAP;
+	error.sequence = sequence;
+	error.major_code = XCB_FREE_PIXMAP;
+	/* full_sequence is not on the wire */
+	return mock_server_send(server, &error, 32);
+}
+
+START_TEST(io_request_check_many)
+{
+	xcb_void_cookie_t cookies[64];
+	xcb_generic_error_t *errors[64];
+	unsigned int i;
+	int n;
+
+	io_connect();
+	mock_server_set_handler(server, free_pixmap_handler, 0);
+	c = mock_server_connect(server);
+	for(i = 0; i < 64; ++i)
+		cookies[i] = xcb_free_pixmap_checked(c, i);
+	n = xcb_request_check_many(c, cookies, 64, errors);
+	fail_unless(n == 32, "expected 32 errors, got %d", n);
+	for(i = 0; i < 64; ++i)
+	{
+		fail_unless(!errors[i] == !!(i & 1), "wrong result for request %u", i);
+		if(errors[i])
+			fail_unless(errors[i]->error_code == XCB_PIXMAP && errors[i]->sequence == cookies[i].sequence,
+				"unexpected error for request %u", i);
+		free(errors[i]);
+	}
+	fail_unless(mock_server_requests(server, XCB_GET_INPUT_FOCUS) == 1, "%d syncs sent for one check",
+		mock_server_requests(server, XCB_GET_INPUT_FOCUS));
+	io_disconnect();
+}
+END_TEST
+
+/* Slows down reading PolyPoint, so senders pile up behind blocked writes,
+ * and fails every FreePixmap with its pixmap as the resource. */
+static int slow_handler(mock_server_t *server, const uint8_t *request, size_t length, uint16_t sequence, void *data)
+{
+	unsigned int *poly_points = data;
+	xcb_generic_error_t error;
+	if(request[0] == XCB_POLY_POINT)
+	{
+		if(++*poly_points % 64 == 0)
+			usleep(2000);
+		return 1;
+	}
+	if(request[0] != XCB_FREE_PIXMAP)
+		return 0;
+	memset(&error, 0, sizeof(error));
+	error.error_code = XCB_PIXMAP;
+	error.sequence = sequence;
+	error.resource_id = *(const uint32_t *) (request + 4);
+	error.major_code = XCB_FREE_PIXMAP;
+	return mock_server_send(server, &error, 32);
+}
+
+#define SENDERS 4
+#define SENDS 256
+
+static void *send_and_check(void *arg)
+{
+	static const xcb_point_t points[1024];
+	uintptr_t sender = (uintptr_t) arg;
+	xcb_void_cookie_t cookies[SENDS];
+	uintptr_t wrong = 0;
+	int i;
+
+	for(i = 0; i < SENDS; ++i)
+	{
+		xcb_poly_point(c, XCB_COORD_MODE_ORIGIN, MOCK_SERVER_ROOT, 0, sizeof(points) / sizeof(*points), points);
+		cookies[i] = xcb_free_pixmap_checked(c, sender << 16 | i);
+	}
+	for(i = 0; i < SENDS; ++i)
+	{
+		xcb_generic_error_t *error = xcb_request_check(c, cookies[i]);
+		if(!error || error->resource_id != (sender << 16 | i))
+			++wrong;
+		free(error);
+	}
+	return (void *) wrong;
+}
+
+START_TEST(io_concurrent_senders)
+{
+	pthread_t senders[SENDERS];
+	unsigned int poly_points = 0;
+	uintptr_t i;
+
+	io_connect();
+	mock_server_set_handler(server, slow_handler, &poly_points);
+	c = mock_server_connect(server);
+	for(i = 0; i < SENDERS; ++i)
+		pthread_create(&senders[i], 0, send_and_check, (void *) i);
+	for(i = 0; i < SENDERS; ++i)
+	{
+		void *wrong;
+		pthread_join(senders[i], &wrong);
+		fail_unless(!wrong, "sender %d saw %d wrong errors", (int) i, (int) (uintptr_t) wrong);
+	}
+	fail_unless(mock_server_requests(server, XCB_POLY_POINT) == SENDERS * SENDS, "server read %d of %d PolyPoints",
+		mock_server_requests(server, XCB_POLY_POINT), SENDERS * SENDS);
+	io_disconnect();
+}
+END_TEST
+
+static void *wait_for_focus(void *arg)
+{
+	free(xcb_get_input_focus_reply(c, xcb_get_input_focus(c), 0));
+	return 0;
+}
+
+#define WRITER_FLOOD 200000
+#define WRITER_POINTS 64000
+#define WRITER_REQUESTS 50
+
+/* A writer that left reading to another thread must take it over when
+ * that thread stops, or a server blocked sending to us never reads the
+ * request the writer is blocked on. */
+START_TEST(io_writer_reads)
+{
+	static xcb_point_t points[WRITER_POINTS];
+	xcb_generic_event_t *event;
+	pthread_t reader;
+	int i;
+
+	io_connect();
+	c = mock_server_connect(server);
+	mock_server_set_latency(server, 200000);
+	pthread_create(&reader, 0, wait_for_focus, 0);
+	usleep(50000);
+	mock_server_flood(server, XCB_MOTION_NOTIFY, WRITER_FLOOD);
+	for(i = 0; i < WRITER_REQUESTS; ++i)
+		xcb_poly_point(c, XCB_COORD_MODE_ORIGIN, MOCK_SERVER_ROOT, 0, WRITER_POINTS, points);
+	xcb_flush(c);
+	pthread_join(reader, 0);
+	mock_server_set_latency(server, 0);
+	free(xcb_get_input_focus_reply(c, xcb_get_input_focus(c), 0));
+	fail_unless(mock_server_requests(server, XCB_POLY_POINT) == WRITER_REQUESTS, "server read %d of %d PolyPoints",
+		mock_server_requests(server, XCB_POLY_POINT), WRITER_REQUESTS);
+	for(i = 0; (event = xcb_poll_for_event(c)); ++i)
+		free(event);
+	fail_unless(i == WRITER_FLOOD, "%d of %d events arrived", i, WRITER_FLOOD);
+	io_disconnect();
+}
+END_TEST
+
+/* Sends, ahead of each GetInputFocus reply, a GenericEvent with 8 bytes
+ * of data, one without, and a GenericEvent passed on by SendEvent, whose
+ * length field means nothing since SendEvent events are always 32 bytes. */
+static int generic_events_handler(mock_server_t *server, const uint8_t *request, size_t length, uint16_t sequence, void *data)
+{
+	uint8_t event[40];
+	if(request[0] != XCB_GET_INPUT_FOCUS)
+		return 0;
+	memset(event, 0, sizeof(event));
+	event[0] = XCB_GE_GENERIC;
+	event[1] = 150;
+	*(uint16_t *) (event + 2) = sequence - 1;
+	*(uint32_t *) (event + 4) = 2;
+	*(uint32_t *) (event + 36) = 0xdeadbeef;
+	if(!mock_server_send(server, event, 40))
+		return 0;
+	*(uint32_t *) (event + 4) = 0;
+	if(!mock_server_send(server, event, 32))
+		return 0;
+	event[0] = XCB_GE_GENERIC | 0x80;
+	*(uint32_t *) (event + 4) = 2;
+	mock_server_send(server, event, 32);
+	return 0;
+}
+
+START_TEST(io_release_event)
+{
+	xcb_ge_event_t *events[3];
+	int i, round;
+
+	io_connect();
+	mock_server_set_handler(server, generic_events_handler, 0);
+	c = mock_server_connect(server);
+	for(round = 0; round < 4; ++round)
+	{
+		free(xcb_get_input_focus_reply(c, xcb_get_input_focus(c), 0));
+		for(i = 0; i < 3; ++i)
+			fail_unless((events[i] = (xcb_ge_event_t *) xcb_poll_for_event(c)) != 0, "event %d missing", i);
+		fail_unless(!xcb_poll_for_event(c), "unexpected event");
+		fail_unless(events[0]->response_type == XCB_GE_GENERIC && events[0]->length == 2,
+			"unexpected first GenericEvent %d/%d", events[0]->response_type, events[0]->length);
+		fail_unless(((uint32_t *) &events[0][1])[1] == 0xdeadbeef, "GenericEvent data lost");
+		fail_unless(events[1]->response_type == XCB_GE_GENERIC && events[1]->length == 0,
+			"unexpected empty GenericEvent %d/%d", events[1]->response_type, events[1]->length);
+		fail_unless(events[2]->response_type == (XCB_GE_GENERIC | 0x80), "unexpected SendEvent type %d",
+			events[2]->response_type);
+		for(i = 0; i < 3; ++i)
+			xcb_release_event(c, (xcb_generic_event_t *) events[i]);
+	}
+	io_disconnect();
+}
+END_TEST
+
+/* Fails FreePixmap of odd pixmaps, and sends a MotionNotify passed on by
+ * SendEvent and two GenericEvents of MOCK-EXTENSION, event types 7 with
+ * data and 8 without, ahead of each GetInputFocus reply. */
+static int handled_events_handler(mock_server_t *server, const uint8_t *request, size_t length, uint16_t sequence, void *data)
+{
+	uint8_t packet[40];
+	memset(packet, 0, sizeof(packet));
+	if(request[0] == XCB_FREE_PIXMAP)
+	{
+		if(!(*(const uint32_t *) (request + 4) & 1))
+			return 1;
+		packet[1] = XCB_PIXMAP;
+		*(uint16_t *) (packet + 2) = sequence;
+		packet[10] = XCB_FREE_PIXMAP;
+		mock_server_send(server, packet, 32);
+		return 1;
+	}
+	if(request[0] != XCB_GET_INPUT_FOCUS)
+		return 0;
+	packet[0] = XCB_MOTION_NOTIFY | 0x80;
+	*(uint16_t *) (packet + 2) = sequence - 1;
+	if(!mock_server_send(server, packet, 32))
+		return 0;
+	packet[0] = XCB_GE_GENERIC;
+	packet[1] = 150;
+	*(uint32_t *) (packet + 4) = 2;
+	*(uint16_t *) (packet + 8) = 7;
+	*(uint32_t *) (packet + 32) = 0xdeadbeef;
+	if(!mock_server_send(server, packet, 40))
+		return 0;
+	*(uint32_t *) (packet + 4) = 0;
+	*(uint16_t *) (packet + 8) = 8;
+	mock_server_send(server, packet, 32);
+	return 0;
+}
+
+struct handled {
+	unsigned int motion, sent, out_of_order, keys, errors, ext, ge;
+};
+
+static uint32_t event_number(const xcb_generic_event_t *event)
+{
+	return *(const uint32_t *) ((const char *) event + 4);
+}
+
+static int handle_motion(const xcb_generic_event_t *event, void *data)
+{
+	struct handled *handled = data;
+	if(event->response_type & 0x80)
+		++handled->sent;
+	else if(event_number(event) != handled->motion++)
+		++handled->out_of_order;
+	return 1;
+}
+
+/* Takes even-numbered key presses, and leaves the others to be queued. */
+static int handle_even_keys(const xcb_generic_event_t *event, void *data)
+{
+	struct handled *handled = data;
+	if(event_number(event) & 1)
+		return 0;
+	++handled->keys;
+	return 1;
+}
+
+static int handle_error(const xcb_generic_event_t *event, void *data)
+{
+	struct handled *handled = data;
+	if(((const xcb_generic_error_t *) event)->error_code == XCB_PIXMAP)
+		++handled->errors;
+	return 1;
+}
+
+static int handle_ext(const xcb_generic_event_t *event, void *data)
+{
+	++((struct handled *) data)->ext;
+	return 1;
+}
+
+static int handle_ge(const xcb_generic_event_t *event, void *data)
+{
+	const xcb_ge_event_t *ge = (const xcb_ge_event_t *) event;
+	struct handled *handled = data;
+	if(ge->event_type == 7 && ge->length == 2 && *(const uint32_t *) &ge[1] == 0xdeadbeef)
+		++handled->ge;
+	return 1;
+}
+
+START_TEST(io_event_handlers)
+{
+	xcb_extension_t present = { "MOCK-EXTENSION" };
+	struct handled handled;
+	xcb_generic_event_t *event;
+	xcb_generic_error_t *error;
+	xcb_void_cookie_t checked;
+	xcb_get_input_focus_cookie_t focus;
+	struct pollfd pfd;
+	int i;
+
+	memset(&handled, 0, sizeof(handled));
+	io_connect();
+	mock_server_set_handler(server, handled_events_handler, 0);
+	c = mock_server_connect(server);
+	fail_unless(xcb_set_event_handler(c, XCB_MOTION_NOTIFY, handle_motion, &handled), "cannot set the MotionNotify handler");
+	fail_unless(xcb_set_event_handler(c, XCB_KEY_PRESS, handle_even_keys, &handled), "cannot set the KeyPress handler");
+	fail_unless(xcb_set_event_handler(c, 0, handle_error, &handled), "cannot set the error handler");
+	fail_unless(xcb_set_extension_event_handler(c, &present, 2, handle_ext, &handled), "cannot set the extension event handler");
+	fail_unless(xcb_set_ge_event_handler(c, &present, 7, handle_ge, &handled), "cannot set the GenericEvent handler");
+
+	/* xcb_dispatch_events runs the handlers for whatever has arrived */
+	mock_server_flood(server, XCB_MOTION_NOTIFY, 100);
+	mock_server_flood(server, XCB_KEY_PRESS, 6);
+	mock_server_flood(server, 102, 3);
+	pfd.fd = xcb_get_file_descriptor(c);
+	pfd.events = POLLIN;
+	while(handled.ext < 3 && poll(&pfd, 1, 1000) == 1)
+		fail_unless(xcb_dispatch_events(c), "xcb_dispatch_events failed");
+	fail_unless(handled.ext == 3, "%u of 3 extension events handled", handled.ext);
+	fail_unless(handled.motion == 100 && !handled.out_of_order, "%u of 100 MotionNotify events handled, %u out of order",
+		handled.motion, handled.out_of_order);
+	fail_unless(handled.keys == 3, "%u of 3 KeyPress events handled", handled.keys);
+	for(i = 1; i < 6; i += 2)
+	{
+		event = xcb_poll_for_queued_event(c);
+		fail_unless(event && event->response_type == XCB_KEY_PRESS && event_number(event) == (uint32_t) i,
+			"declined KeyPress %d not queued", i);
+		free(event);
+	}
+	fail_unless(!xcb_poll_for_queued_event(c), "handled event queued");
+
+	/* unchecked errors, SendEvent and GenericEvents; errors for checked
+	 * requests stay with the request */
+	xcb_free_pixmap(c, 1);
+	checked = xcb_free_pixmap_checked(c, 3);
+	focus = xcb_get_input_focus(c);
+	error = xcb_request_check(c, checked);
+	fail_unless(error && error->error_code == XCB_PIXMAP, "checked error handled");
+	free(error);
+	free(xcb_get_input_focus_reply(c, focus, 0));
+	fail_unless(handled.errors == 1, "%u of 1 unchecked errors handled", handled.errors);
+	fail_unless(handled.sent == 1, "%u of 1 SendEvent MotionNotify events handled", handled.sent);
+	fail_unless(handled.ge == 1, "%u of 1 GenericEvents handled", handled.ge);
+	event = xcb_poll_for_queued_event(c);
+	fail_unless(event && event->response_type == XCB_GE_GENERIC && ((xcb_ge_event_t *) event)->event_type == 8,
+		"GenericEvent without a handler not queued");
+	free(event);
+	fail_unless(!xcb_poll_for_queued_event(c), "handled event queued");
+
+	/* removing a handler queues its events again */
+	fail_unless(xcb_set_event_handler(c, XCB_MOTION_NOTIFY, 0, 0), "cannot remove the MotionNotify handler");
+	mock_server_flood(server, XCB_MOTION_NOTIFY, 2);
+	for(i = 0; i < 2; ++i)
+	{
+		event = xcb_wait_for_event(c);
+		fail_unless(event && event->response_type == XCB_MOTION_NOTIFY, "MotionNotify %d not queued", i);
+		free(event);
+	}
+	fail_unless(handled.motion == 100, "removed handler called");
+	io_disconnect();
+}
+END_TEST
+
+#define ROUND_TRIPPERS 4
+#define ROUND_TRIPS 200
+#define READER_FLOOD 1000
+
+static void *round_trips(void *arg)
+{
+	uintptr_t wrong = 0;
+	int i;
+	for(i = 0; i < ROUND_TRIPS; ++i)
+	{
+		xcb_get_input_focus_reply_t *focus = xcb_get_input_focus_reply(c, xcb_get_input_focus(c), 0);
+		if(!focus || focus->focus != MOCK_SERVER_ROOT)
+			++wrong;
+		free(focus);
+	}
+	return (void *) wrong;
+}
+
+static void *consume_events(void *arg)
+{
+	uintptr_t wrong = 0;
+	uint32_t i;
+	for(i = 0; i < READER_FLOOD; ++i)
+	{
+		xcb_generic_event_t *event = xcb_wait_for_event(c);
+		if(!event)
+			return (void *) (uintptr_t) (READER_FLOOD - i + wrong);
+		if(event->response_type != XCB_MOTION_NOTIFY || event_number(event) != i)
+			++wrong;
+		free(event);
+	}
+	return (void *) wrong;
+}
+
+START_TEST(io_reader_thread)
+{
+	pthread_t threads[ROUND_TRIPPERS + 1];
+	void *wrong;
+	int i;
+
+	io_connect();
+	c = mock_server_connect(server);
+	fail_unless(xcb_enable_reader_thread(c), "cannot start the reader thread");
+	fail_unless(xcb_enable_reader_thread(c), "starting the reader thread again failed");
+	pthread_create(&threads[ROUND_TRIPPERS], 0, consume_events, 0);
+	for(i = 0; i < ROUND_TRIPPERS; ++i)
+		pthread_create(&threads[i], 0, round_trips, 0);
+	mock_server_flood(server, XCB_MOTION_NOTIFY, READER_FLOOD);
+	for(i = 0; i < ROUND_TRIPPERS; ++i)
+	{
+		pthread_join(threads[i], &wrong);
+		fail_unless(!wrong, "round tripper %d got %d wrong replies", i, (int) (uintptr_t) wrong);
+	}
+	pthread_join(threads[ROUND_TRIPPERS], &wrong);
+	fail_unless(!wrong, "event consumer got %d wrong or missing events", (int) (uintptr_t) wrong);
+	fail_unless(mock_server_requests(server, XCB_GET_INPUT_FOCUS) == ROUND_TRIPPERS * ROUND_TRIPS,
+		"server read %d of %d GetInputFocus requests",
+		mock_server_requests(server, XCB_GET_INPUT_FOCUS), ROUND_TRIPPERS * ROUND_TRIPS);
+	io_disconnect();
+
+	/* disconnecting stops the reader thread, even in the middle of a flood */
+	io_connect();
+	c = mock_server_connect(server);
+	fail_unless(xcb_enable_reader_thread(c), "cannot start the reader thread");
+	mock_server_flood(server, XCB_MOTION_NOTIFY, 100 * READER_FLOOD);
+	free(xcb_wait_for_event(c));
+	io_disconnect();
+}
+END_TEST
+
+/* An allocator free() cannot release, so that anything XCB frees itself
+ * instead of handing back to the allocator shows up. */
+struct offset_allocator {
+	int live;
+	int bad_releases;
+};
+
+#define ALLOC_OFFSET 16
+#define ALLOC_MAGIC 0x0ffa110c
+
+static void *offset_alloc(size_t size, void *data)
+{
+	struct offset_allocator *allocator = data;
+	char *p = malloc(size + ALLOC_OFFSET);
+	if(!p)
+		return 0;
+	*(uint32_t *) p = ALLOC_MAGIC;
+	++allocator->live;
+	return p + ALLOC_OFFSET;
+}
+
+static void offset_release(void *ptr, void *data)
+{
+	struct offset_allocator *allocator = data;
+	char *p = (char *) ptr - ALLOC_OFFSET;
+	if(*(uint32_t *) p != ALLOC_MAGIC)
+	{
+		++allocator->bad_releases;
+		return;
+	}
+	*(uint32_t *) p = 0;
+	--allocator->live;
+	free(p);
+}
+
+#define MOCK_XC_MISC_OPCODE 151
+#define MOCK_BIG_REQUESTS_OPCODE 152
+
+/* Answers XC-MISC GetXIDRange and BIG-REQUESTS Enable. */
+static int xid_range_handler(mock_server_t *server, const uint8_t *request, size_t length, uint16_t sequence, void *data)
+{
+	union {
+		xcb_xc_misc_get_xid_range_reply_t range;
+		xcb_big_requests_enable_reply_t enable;
+		uint8_t bytes[32];
+	} reply;
+	memset(&reply, 0, sizeof(reply));
+	reply.range.response_type = 1;
+	reply.range.sequence = sequence;
+	if(request[0] == MOCK_XC_MISC_OPCODE && request[1] == XCB_XC_MISC_GET_XID_RANGE)
+	{
+		reply.range.start_id = 0x1000;
+		reply.range.count = 16;
+	}
+	else if(request[0] == MOCK_BIG_REQUESTS_OPCODE && request[1] == XCB_BIG_REQUESTS_ENABLE)
+		reply.enable.maximum_request_length = 0x100000;
+	else
+		return 0;
+	return mock_server_send(server, &reply, sizeof(reply));
+}
+
+START_TEST(io_allocator)
+{
+	static struct offset_allocator allocator;
+	xcb_extension_t present = { "MOCK-EXTENSION" };
+	const xcb_query_extension_reply_t *ext;
+	xcb_get_input_focus_reply_t *focus;
+	xcb_generic_error_t *error;
+	xcb_generic_event_t *event;
+	uint32_t id, i;
+
+	io_connect();
+	mock_server_add_extension(server, "XC-MISC", MOCK_XC_MISC_OPCODE, 0, 0);
+	mock_server_add_extension(server, "BIG-REQUESTS", MOCK_BIG_REQUESTS_OPCODE, 0, 0);
+	mock_server_set_handler(server, xid_range_handler, 0);
+	c = mock_server_connect(server);
+	fail_unless(xcb_set_allocator(c, offset_alloc, offset_release, &allocator), "cannot set the allocator");
+
+	error = xcb_request_check(c, xcb_free_pixmap_checked(c, 1));
+	fail_unless(!error, "FreePixmap failed");
+	ext = xcb_get_extension_data(c, &present);
+	fail_unless(ext && ext->present && ext->major_opcode == 150, "extension not found");
+	fail_unless(xcb_get_maximum_request_length(c) == 0x100000, "BIG-REQUESTS not enabled");
+
+	/* use up the setup's XIDs, then refill from XC-MISC */
+	for(i = 0; i <= 0x001fffff; ++i)
+		id = xcb_generate_id(c);
+	fail_unless(id == (0x00400000 | 0x001fffff), "unexpected last setup XID 0x%x", id);
+	id = xcb_generate_id(c);
+	fail_unless(id == (0x00400000 | 0x1000), "unexpected refilled XID 0x%x", id);
+
+	focus = xcb_get_input_focus_reply(c, xcb_get_input_focus(c), 0);
+	fail_unless(focus && focus->focus == MOCK_SERVER_ROOT, "no GetInputFocus reply");
+	offset_release(focus, &allocator);
+	mock_server_flood(server, XCB_MOTION_NOTIFY, 4);
+	for(i = 0; i < 4; ++i)
+	{
+		event = xcb_wait_for_event(c);
+		fail_unless(event && event->response_type == XCB_MOTION_NOTIFY, "missing event %d", i);
+		if(i & 1)
+			xcb_release_event(c, event);
+		else
+			offset_release(event, &allocator);
+	}
+	fail_unless(mock_server_requests(server, MOCK_XC_MISC_OPCODE) == 1, "XIDs refilled %d times",
+		mock_server_requests(server, MOCK_XC_MISC_OPCODE));
+	io_disconnect();
+	fail_unless(!allocator.bad_releases, "%d buffers released twice or not from the allocator", allocator.bad_releases);
+	fail_unless(!allocator.live, "%d buffers not released", allocator.live);
+}
+END_TEST
+
+START_TEST(io_reply_buffer)
+{
+	static struct offset_allocator allocator;
+	union {
+		xcb_get_input_focus_reply_t reply;
+		uint8_t bytes[32];
+	} buffer, small;
+	xcb_get_input_focus_cookie_t cookies[3];
+	xcb_get_input_focus_reply_t *focus;
+
+	io_connect();
+	c = mock_server_connect(server);
+	fail_unless(xcb_set_allocator(c, offset_alloc, offset_release, &allocator), "cannot set the allocator");
+	cookies[0] = xcb_get_input_focus(c);
+	cookies[1] = xcb_get_input_focus(c);
+	cookies[2] = xcb_get_input_focus(c);
+	fail_unless(xcb_set_reply_buffer(c, cookies[0].sequence, &buffer, sizeof(buffer)), "reply buffer refused");
+	fail_unless(xcb_set_reply_buffer(c, cookies[1].sequence, &small, sizeof(xcb_generic_reply_t)), "small reply buffer refused");
+	fail_unless(xcb_set_reply_buffer(c, cookies[2].sequence, &buffer, sizeof(buffer)), "reply buffer refused");
+
+	focus = xcb_get_input_focus_reply(c, cookies[0], 0);
+	fail_unless(focus == &buffer.reply, "reply not read into the buffer");
+	fail_unless(focus->focus == MOCK_SERVER_ROOT, "unexpected focus 0x%x", focus->focus);
+	focus = xcb_get_input_focus_reply(c, cookies[1], 0);
+	fail_unless(focus && focus != &small.reply, "reply read into a buffer too small for it");
+	fail_unless(focus->focus == MOCK_SERVER_ROOT, "unexpected focus 0x%x", focus->focus);
+	offset_release(focus, &allocator);
+	/* a reply read into the caller's buffer is not the allocator's to free */
+	xcb_discard_reply(c, cookies[2].sequence);
+	xcb_request_check(c, xcb_no_operation_checked(c));
+	fail_unless(!xcb_set_reply_buffer(c, cookies[2].sequence, &buffer, sizeof(buffer)), "reply buffer set too late");
+	fail_unless(allocator.live == 0, "%d buffers not released", allocator.live);
+	io_disconnect();
+	fail_unless(!allocator.bad_releases, "%d buffers released twice or not from the allocator", allocator.bad_releases);
+	fail_unless(!allocator.live, "%d buffers not released", allocator.live);
+}
+END_TEST
+
+#define TRACE_LOG_MAX 64
+
+struct trace_log {
+	int len;
+	unsigned int written;
+	struct {
+		xcb_trace_point_t point;
+		unsigned int sequence;
+		uint8_t major_opcode;
+		uint16_t minor_opcode;
+		uint32_t size;
+		uint8_t response_type;
+	} records[TRACE_LOG_MAX];
+};
+
+/* Logs what was sent and read; writes are only added up, and blocking
+ * depends on timing. */
+static void log_trace(const xcb_trace_record_t *record, void *data)
+{
+	struct trace_log *log = data;
+	if(record->point == XCB_TRACE_WRITE)
+		log->written += record->size;
+	if(record->point == XCB_TRACE_WRITE || record->point == XCB_TRACE_BLOCK ||
+	   record->point == XCB_TRACE_RESUME || log->len == TRACE_LOG_MAX)
+		return;
+	log->records[log->len].point = record->point;
+	log->records[log->len].sequence = record->sequence;
+	log->records[log->len].major_opcode = record->major_opcode;
+	log->records[log->len].minor_opcode = record->minor_opcode;
+	log->records[log->len].size = record->size;
+	log->records[log->len].response_type = record->data ? *(const uint8_t *) record->data : 0;
+	++log->len;
+}
+
+START_TEST(io_trace_hook)
+{
+	static const struct {
+		xcb_trace_point_t point;
+		unsigned int sequence;
+		uint8_t major_opcode;
+		uint16_t minor_opcode;
+		uint32_t size;
+		uint8_t response_type;
+	} expected[] = {
+		{ XCB_TRACE_REQUEST, 1, XCB_FREE_PIXMAP, 0, 8, XCB_FREE_PIXMAP },
+		{ XCB_TRACE_REQUEST, 2, XCB_GET_INPUT_FOCUS, 0, 4, XCB_GET_INPUT_FOCUS },
+		{ XCB_TRACE_ERROR, 1, XCB_FREE_PIXMAP, 0, 32, 0 },
+		{ XCB_TRACE_EVENT, 1, XCB_MOTION_NOTIFY | 0x80, 0, 32, XCB_MOTION_NOTIFY | 0x80 },
+		{ XCB_TRACE_EVENT, 1, XCB_GE_GENERIC, 7, 40, XCB_GE_GENERIC },
+		{ XCB_TRACE_EVENT, 1, XCB_GE_GENERIC, 8, 32, XCB_GE_GENERIC },
+		{ XCB_TRACE_REPLY, 2, 0, 0, 32, 1 },
+	};
+	static struct trace_log log;
+	xcb_generic_event_t *event;
+	int i;
+
+	io_connect();
+	mock_server_set_handler(server, handled_events_handler, 0);
+	c = mock_server_connect(server);
+	if(!xcb_set_trace_hook(c, log_trace, &log))
+	{
+		/* tracing is compiled out */
+		io_disconnect();
+		return;
+	}
+	xcb_free_pixmap(c, 1);
+	free(xcb_get_input_focus_reply(c, xcb_get_input_focus(c), 0));
+	fail_unless(log.len == sizeof(expected) / sizeof(*expected), "%d trace records, not %d",
+		log.len, (int) (sizeof(expected) / sizeof(*expected)));
+	for(i = 0; i < log.len; ++i)
+		fail_unless(log.records[i].point == expected[i].point && log.records[i].sequence == expected[i].sequence &&
+			log.records[i].major_opcode == expected[i].major_opcode && log.records[i].minor_opcode == expected[i].minor_opcode &&
+			log.records[i].size == expected[i].size && log.records[i].response_type == expected[i].response_type,
+			"trace record %d is %d/%u/%d/%d/%u/%d", i, log.records[i].point, log.records[i].sequence,
+			log.records[i].major_opcode, log.records[i].minor_opcode, log.records[i].size, log.records[i].response_type);
+	fail_unless(log.written == 12, "%u bytes traced as written, not 12", log.written);
+	while((event = xcb_poll_for_event(c)))
+		free(event);
+
+	fail_unless(xcb_set_trace_hook(c, 0, 0), "cannot remove the trace hook");
+	free(xcb_get_input_focus_reply(c, xcb_get_input_focus(c), 0));
+	fail_unless(log.len == sizeof(expected) / sizeof(*expected), "traced after the hook was removed");
+	io_disconnect();
+}
+END_TEST
+
+/* Reads a whole file into a NUL-terminated buffer. */
+static char *read_file(const char *path, size_t *len)
+{
+	FILE *f = fopen(path, "rb");
+	char *buf = 0;
+	long size;
+	if(!f)
+		return 0;
+	if(!fseek(f, 0, SEEK_END) && (size = ftell(f)) >= 0 && !fseek(f, 0, SEEK_SET) &&
+	   (buf = malloc(size + 1)))
+	{
+		*len = fread(buf, 1, size, f);
+		buf[*len] = '\0';
+	}
+	fclose(f);
+	return buf;
+}
+
+static int count_substrings(const char *s, const char *sub)
+{
+	int n = 0;
+	while((s = strstr(s, sub)))
+	{
+		++n;
+		s += strlen(sub);
+	}
+	return n;
+}
+
+static xcb_connection_t *round_trip_connection(mock_server_t **mock)
+{
+	xcb_connection_t *conn;
+	*mock = mock_server_new();
+	conn = mock_server_connect(*mock);
+	free(xcb_get_input_focus_reply(conn, xcb_get_input_focus(conn), 0));
+	return conn;
+}
+
+static void round_trip_disconnect(xcb_connection_t *conn, mock_server_t *mock)
+{
+	fail_unless(!xcb_connection_has_error(conn), "connection failed");
+	xcb_disconnect(conn);
+	mock_server_free(mock);
+}
+
+START_TEST(io_trace_file)
+{
+	static const char trace_start[] = "[{\"name\":\"process_name\",\"ph\":\"M\"";
+	char path[] = "/tmp/check_io-trace-XXXXXX";
+	mock_server_t *mocks[3];
+	xcb_connection_t *conns[3];
+	size_t len;
+	char *trace;
+	int tracing, fd;
+
+	/* only check the file if tracing is compiled in */
+	io_connect();
+	c = mock_server_connect(server);
+	tracing = xcb_set_trace_hook(c, 0, 0);
+	io_disconnect();
+	if(!tracing)
+		return;
+	fd = mkstemp(path);
+	fail_unless(fd >= 0, "cannot create a trace file");
+	close(fd);
+	setenv("XCB_TRACE_FILE", path, 1);
+
+	/* two connections share the file, which is finished by the last */
+	conns[0] = round_trip_connection(&mocks[0]);
+	conns[1] = round_trip_connection(&mocks[1]);
+	round_trip_disconnect(conns[0], mocks[0]);
+	round_trip_disconnect(conns[1], mocks[1]);
+	trace = read_file(path, &len);
+	fail_unless(trace != 0, "cannot read the trace file");
+	fail_unless(!strncmp(trace, trace_start, strlen(trace_start)), "trace file does not start a JSON array");
+	fail_unless(len >= 3 && !strcmp(trace + len - 3, "\n]\n"), "trace file does not end the JSON array");
+	fail_unless(count_substrings(trace, "\"name\":\"request\",\"ph\":\"i\"") == 2, "requests not traced");
+	fail_unless(count_substrings(trace, "\"name\":\"reply\",\"ph\":\"i\"") == 2, "replies not traced");
+	fail_unless(count_substrings(trace, "\"name\":\"wait\",\"ph\":\"B\"") ==
+		count_substrings(trace, "\"name\":\"wait\",\"ph\":\"E\""), "unbalanced waits");
+	free(trace);
+
+	/* a later connection extends the finished file */
+	conns[2] = round_trip_connection(&mocks[2]);
+	round_trip_disconnect(conns[2], mocks[2]);
+	unsetenv("XCB_TRACE_FILE");
+	trace = read_file(path, &len);
+	unlink(path);
+	fail_unless(trace != 0, "cannot read the trace file");
+	fail_unless(count_substrings(trace, "process_name") == 1, "trace file started over");
+	fail_unless(len >= 3 && !strcmp(trace + len - 3, "\n]\n"), "extended trace file does not end the JSON array");
+	fail_unless(count_substrings(trace, "\"name\":\"reply\",\"ph\":\"i\"") == 3, "later connection not traced");
+	fail_unless(count_substrings(trace, "\n]") == 1, "trace file has two ends");
+	free(trace);
+}
+END_TEST
+
+struct wire {
+	uint8_t written[256];
+	size_t written_len;
+	uint8_t sent[256];
+	size_t sent_len;
+};
+
+/* Records every request, and answers GetInputFocus itself with an event
+ * and a reply it records too. */
+static int recording_handler(mock_server_t *server, const uint8_t *request, size_t length, uint16_t sequence, void *data)
+{
+	struct wire *wire = data;
+	uint8_t packet[64];
+	if(wire->written_len + length <= sizeof(wire->written))
+		memcpy(wire->written + wire->written_len, request, length);
+	wire->written_len += length;
+	if(request[0] != XCB_GET_INPUT_FOCUS)
+		return 0;
+	memset(packet, 0, sizeof(packet));
+	packet[0] = XCB_MOTION_NOTIFY;
+	*(uint16_t *) (packet + 2) = sequence - 1;
+	*(uint32_t *) (packet + 4) = 0x12345678;
+	packet[32] = 1; /* reply */
+	packet[33] = XCB_INPUT_FOCUS_PARENT;
+	*(uint16_t *) (packet + 34) = sequence;
+	*(uint32_t *) (packet + 40) = MOCK_SERVER_ROOT;
+	if(wire->sent_len + sizeof(packet) <= sizeof(wire->sent))
+		memcpy(wire->sent + wire->sent_len, packet, sizeof(packet));
+	wire->sent_len += sizeof(packet);
+	mock_server_send(server, packet, sizeof(packet));
+	return 1;
+}
+
+/* Checks a capture file's header and collects each direction's bytes
+ * from its records. */
+static int read_capture(const char *path, struct wire *wire, size_t *setup_len)
+{
+	const xcb_capture_header_t *header;
+	size_t len, pos;
+	uint64_t last = 0;
+	char *capture = read_file(path, &len);
+	int ok;
+
+	memset(wire, 0, sizeof(*wire));
+	*setup_len = 0;
+	if(!capture)
+		return 0;
+	header = (const xcb_capture_header_t *) capture;
+	ok = len >= sizeof(*header) && !memcmp(header->magic, XCB_CAPTURE_MAGIC, sizeof(header->magic)) &&
+		header->byte_order == XCB_CAPTURE_BYTE_ORDER;
+	for(pos = sizeof(*header); ok && pos < len; )
+	{
+		xcb_capture_record_t record;
+		const char *bytes = capture + pos + sizeof(record);
+		size_t skip;
+		memcpy(&record, capture + pos, sizeof(record));
+		ok = pos + sizeof(record) + record.length <= len && record.timestamp >= last &&
+			record.direction <= XCB_CAPTURE_READ;
+		last = record.timestamp;
+		if(!ok)
+			break;
+		/* the setup is not a request, so its bytes are set aside */
+		skip = 0;
+		if(record.direction == XCB_CAPTURE_WRITE && !record.sequence && !*setup_len)
+			skip = *setup_len = record.length;
+		if(record.direction == XCB_CAPTURE_WRITE)
+		{
+			if(wire->written_len + record.length - skip <= sizeof(wire->written))
+				memcpy(wire->written + wire->written_len, bytes + skip, record.length - skip);
+			wire->written_len += record.length - skip;
+		}
+		else
+		{
+			if(wire->sent_len + record.length <= sizeof(wire->sent))
+				memcpy(wire->sent + wire->sent_len, bytes, record.length);
+			wire->sent_len += record.length;
+		}
+		pos += sizeof(record) + record.length + XCB_CAPTURE_PAD(record.length);
+	}
+	free(capture);
+	return ok;
+}
+
+START_TEST(io_capture_file)
+{
+	char path[] = "/tmp/check_io-capture-XXXXXX";
+	char later[sizeof(path) + 2];
+	struct wire wire, captured;
+	mock_server_t *mocks[2];
+	xcb_connection_t *conns[2];
+	size_t setup_len, server_setup_len;
+	int tracing, fd, i;
+
+	/* only check the files if capture is compiled in */
+	io_connect();
+	c = mock_server_connect(server);
+	tracing = xcb_set_trace_hook(c, 0, 0);
+	io_disconnect();
+	if(!tracing)
+		return;
+	fd = mkstemp(path);
+	fail_unless(fd >= 0, "cannot create a capture file");
+	close(fd);
+	setenv("XCB_CAPTURE_FILE", path, 1);
+
+	memset(&wire, 0, sizeof(wire));
+	io_connect();
+	mock_server_set_handler(server, recording_handler, &wire);
+	c = mock_server_connect(server);
+	server_setup_len = xcb_get_setup(c)->length * 4 + 8;
+	xcb_free_pixmap(c, 1);
+	free(xcb_intern_atom_reply(c, xcb_intern_atom(c, 0, strlen("MOCK_ATOM"), "MOCK_ATOM"), 0));
+	free(xcb_get_input_focus_reply(c, xcb_get_input_focus(c), 0));
+	free(xcb_wait_for_event(c));
+	io_disconnect();
+
+	/* later connections get files of their own */
+	conns[0] = round_trip_connection(&mocks[0]);
+	conns[1] = round_trip_connection(&mocks[1]);
+	round_trip_disconnect(conns[0], mocks[0]);
+	round_trip_disconnect(conns[1], mocks[1]);
+	unsetenv("XCB_CAPTURE_FILE");
+
+	fail_unless(read_capture(path, &captured, &setup_len), "malformed capture file");
+	unlink(path);
+	fail_unless(setup_len == 12, "captured a %d byte setup request, not 12", (int) setup_len);
+	fail_unless(captured.written_len == wire.written_len && !memcmp(captured.written, wire.written, wire.written_len),
+		"captured %d bytes written, the server read %d", (int) captured.written_len, (int) wire.written_len);
+	/* the server's setup, the InternAtom reply, then what the handler sent */
+	fail_unless(captured.sent_len == server_setup_len + 32 + wire.sent_len, "captured %d bytes read, not %d",
+		(int) captured.sent_len, (int) (server_setup_len + 32 + wire.sent_len));
+	fail_unless(captured.sent[0] == 1, "setup not captured");
+	fail_unless(!memcmp(captured.sent + captured.sent_len - wire.sent_len, wire.sent, wire.sent_len),
+		"captured bytes differ from what the server sent");
+	for(i = 2; i <= 3; ++i)
+	{
+		sprintf(later, "%s.%d", path, i);
+		fail_unless(read_capture(later, &captured, &setup_len), "malformed capture file for connection %d", i);
+		unlink(later);
+		fail_unless(setup_len == 12 && captured.written_len == 4 && captured.written[0] == XCB_GET_INPUT_FOCUS,
+			"connection %d's requests not captured", i);
+		fail_unless(captured.sent_len == server_setup_len + 32, "connection %d's input not captured", i);
+	}
+}
+END_TEST
+
+/* }}} */
+
+Suite *io_suite(void)
+{
+	Suite *s = suite_create("Connection I/O");
+	suite_add_test(s, io_setup, "connection setup");
+	suite_add_test(s, io_connect_timings, "xcb_get_connect_timings");
+	suite_add_test(s, io_statistics_after_error, "statistics after an error");
+	suite_add_test(s, io_round_trip, "round trips");
+	suite_add_test(s, io_extension, "extension lookup");
+	suite_add_test(s, io_latency, "reply latency");
+	suite_add_test(s, io_timeouts, "timeouts");
+	suite_add_test(s, io_event_order, "event order");
+	suite_add_test(s, io_event_batches, "event batches");
+	suite_add_test(s, io_queued_events, "queued-only polls and peeks");
+	suite_add_test(s, io_event_fd, "xcb_get_event_fd");
+	suite_add_test(s, io_coalescing, "event coalescing");
+	suite_add_test(s, io_request_check_many, "xcb_request_check_many");
+	suite_add_test(s, io_concurrent_senders, "concurrent senders");
+	suite_add_test(s, io_writer_reads, "writer reading for a reader that left");
+	suite_add_test(s, io_release_event, "xcb_release_event");
+	suite_add_test(s, io_event_handlers, "event handlers");
+	suite_add_test(s, io_reader_thread, "xcb_enable_reader_thread");
+	suite_add_test(s, io_allocator, "internal replies from xcb_set_allocator");
+	suite_add_test(s, io_reply_buffer, "xcb_set_reply_buffer");
+	suite_add_test(s, io_trace_hook, "xcb_set_trace_hook");
+	suite_add_test(s, io_trace_file, "XCB_TRACE_FILE");
+	suite_add_test(s, io_capture_file, "XCB_CAPTURE_FILE");
+	return s;
+}
@@ -2,3 +2,4 @@
 
 void suite_add_test(Suite *s, TFun tf, const char *name);
 Suite *public_suite(void);
+Suite *io_suite(void);
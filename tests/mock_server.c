@@ -0,0 +1,452 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include "mock_server.h"
+
+/* A client that hangs up in the middle of a flood must not kill the
+ * process with SIGPIPE. */
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define MAX_EXTENSIONS 8
+#define FIRST_ATOM 69 /* after the predefined atoms */
+
+struct extension {
+	char *name;
+	uint8_t major_opcode;
+	uint8_t first_event;
+	uint8_t first_error;
+};
+
+struct flood {
+	struct flood *next;
+	uint8_t response_type;
+	unsigned int count;
+};
+
+struct mock_server_t {
+	int fd;
+	int wake[2];
+	pthread_t thread;
+	int running;
+
+	mock_request_handler_t handler;
+	void *handler_data;
+	struct extension extensions[MAX_EXTENSIONS];
+	int extensions_len;
+	volatile unsigned int latency;
+
+	/* guards everything below */
+	pthread_mutex_t lock;
+	struct flood *floods;
+	struct flood **floods_tail;
+	unsigned int requests[256];
+
+	/* only the server thread uses these */
+	uint16_t sequence;
+	char **atoms;
+	int atoms_len;
+};
+
+static struct {
+	xcb_setup_t setup;
+	char vendor[4];
+	xcb_format_t format;
+	xcb_screen_t screen;
+	xcb_depth_t depth;
+	xcb_visualtype_t visual;
+} canned_setup;
+
+static int read_all(int fd, void *buf, size_t len)
+{
+	size_t done = 0;
+	while(done < len)
+	{
+		ssize_t ret = read(fd, (char *) buf + done, len - done);
+		if(ret < 0 && errno == EINTR)
+			continue;
+		if(ret <= 0)
+			return 0;
+		done += ret;
+	}
+	return 1;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	size_t done = 0;
+	while(done < len)
+	{
+		ssize_t ret = send(fd, (const char *) buf + done, len - done, MSG_NOSIGNAL);
+		if(ret < 0 && errno == EINTR)
+			continue;
+		if(ret <= 0)
+			return 0;
+		done += ret;
+	}
+	return 1;
+}
+
+static void init_setup(void)
+{
+	canned_setup.setup.status = 1;
+	canned_setup.setup.protocol_major_version = X_PROTOCOL;
+	canned_setup.setup.protocol_minor_version = X_PROTOCOL_REVISION;
+	canned_setup.setup.length = (sizeof(canned_setup) - 8) / 4;
+	canned_setup.setup.resource_id_base = 0x00400000;
+	canned_setup.setup.resource_id_mask = 0x001fffff;
+	canned_setup.setup.vendor_len = sizeof(canned_setup.vendor);
+	canned_setup.setup.maximum_request_length = 0xffff;
+	canned_setup.setup.roots_len = 1;
+	canned_setup.setup.pixmap_formats_len = 1;
+	canned_setup.setup.bitmap_format_scanline_unit = 32;
+	canned_setup.setup.bitmap_format_scanline_pad = 32;
+	canned_setup.setup.min_keycode = 8;
+	canned_setup.setup.max_keycode = 255;
+	memcpy(canned_setup.vendor, "mock", sizeof(canned_setup.vendor));
+
+	canned_setup.format.depth = 24;
+	canned_setup.format.bits_per_pixel = 32;
+	canned_setup.format.scanline_pad = 32;
+
+	canned_setup.screen.root = MOCK_SERVER_ROOT;
+	canned_setup.screen.default_colormap = 0x20;
+	canned_setup.screen.white_pixel = 0xffffff;
+	canned_setup.screen.width_in_pixels = 1024;
+	canned_setup.screen.height_in_pixels = 768;
+	canned_setup.screen.width_in_millimeters = 270;
+	canned_setup.screen.height_in_millimeters = 203;
+	canned_setup.screen.min_installed_maps = 1;
+	canned_setup.screen.max_installed_maps = 1;
+	canned_setup.screen.root_visual = MOCK_SERVER_ROOT_VISUAL;
+	canned_setup.screen.root_depth = 24;
+	canned_setup.screen.allowed_depths_len = 1;
+
+	canned_setup.depth.depth = 24;
+	canned_setup.depth.visuals_len = 1;
+
+	canned_setup.visual.visual_id = MOCK_SERVER_ROOT_VISUAL;
+	canned_setup.visual._class = XCB_VISUAL_CLASS_TRUE_COLOR;
+	canned_setup.visual.bits_per_rgb_value = 8;
+	canned_setup.visual.colormap_entries = 256;
+	canned_setup.visual.red_mask = 0xff0000;
+	canned_setup.visual.green_mask = 0x00ff00;
+	canned_setup.visual.blue_mask = 0x0000ff;
+}
+
+static int send_reply(mock_server_t *server, uint8_t *reply, size_t length)
+{
+	reply[0] = 1; /* X_Reply */
+	*(uint16_t *) (reply + 2) = server->sequence;
+	*(uint32_t *) (reply + 4) = (length - 32) / 4;
+	if(server->latency)
+		usleep(server->latency);
+	return write_all(server->fd, reply, length);
+}
+
+static uint32_t intern_atom(mock_server_t *server, const char *name, size_t len, int only_if_exists)
+{
+	char **atoms;
+	int i;
+	for(i = 0; i < server->atoms_len; ++i)
+		if(strlen(server->atoms[i]) == len && !memcmp(server->atoms[i], name, len))
+			return FIRST_ATOM + i;
+	if(only_if_exists)
+		return XCB_ATOM_NONE;
+	atoms = realloc(server->atoms, (server->atoms_len + 1) * sizeof(*atoms));
+	if(!atoms)
+		return XCB_ATOM_NONE;
+	server->atoms = atoms;
+	atoms[server->atoms_len] = malloc(len + 1);
+	if(!atoms[server->atoms_len])
+		return XCB_ATOM_NONE;
+	memcpy(atoms[server->atoms_len], name, len);
+	atoms[server->atoms_len][len] = '\0';
+	return FIRST_ATOM + server->atoms_len++;
+}
+
+static int handle_request(mock_server_t *server, const uint8_t *request, size_t length)
+{
+	uint8_t reply[32];
+	uint16_t name_len = length >= 8 ? *(const uint16_t *) (request + 4) : 0;
+	int i;
+
+	if(server->handler && server->handler(server, request, length, server->sequence, server->handler_data))
+		return 1;
+	if(8 + (size_t) name_len > length)
+		name_len = 0;
+
+	memset(reply, 0, sizeof(reply));
+	switch(request[0])
+	{
+	case XCB_GET_INPUT_FOCUS:
+		reply[1] = XCB_INPUT_FOCUS_POINTER_ROOT;
+		*(uint32_t *) (reply + 8) = MOCK_SERVER_ROOT;
+		return send_reply(server, reply, sizeof(reply));
+	case XCB_INTERN_ATOM:
+		*(uint32_t *) (reply + 8) = intern_atom(server, (const char *) request + 8, name_len, request[1]);
+		return send_reply(server, reply, sizeof(reply));
+	case XCB_QUERY_EXTENSION:
+		for(i = 0; i < server->extensions_len; ++i)
+		{
+			struct extension *ext = &server->extensions[i];
+			if(strlen(ext->name) == name_len && !memcmp(ext->name, request + 8, name_len))
+			{
+				reply[8] = 1;
+				reply[9] = ext->major_opcode;
+				reply[10] = ext->first_event;
+				reply[11] = ext->first_error;
+			}
+		}
+		return send_reply(server, reply, sizeof(reply));
+	}
+	return 1;
+}
+
+static int send_floods(mock_server_t *server)
+{
+	struct flood *flood;
+	char byte;
+	if(read(server->wake[0], &byte, 1) != 1)
+		return 0;
+	pthread_mutex_lock(&server->lock);
+	flood = server->floods;
+	server->floods = 0;
+	server->floods_tail = &server->floods;
+	pthread_mutex_unlock(&server->lock);
+
+	while(flood)
+	{
+		struct flood *next = flood->next;
+		uint8_t events[32 * 64];
+		unsigned int i, n = 0;
+		for(i = 0; i < flood->count; ++i)
+		{
+			uint8_t *event = events + 32 * n;
+			memset(event, 0, 32);
+			event[0] = flood->response_type;
+			*(uint16_t *) (event + 2) = server->sequence;
+			*(uint32_t *) (event + 4) = i;
+			if(++n == 64 || i + 1 == flood->count)
+			{
+				if(!write_all(server->fd, events, 32 * n))
+					break;
+				n = 0;
+			}
+		}
+		free(flood);
+		flood = next;
+	}
+	return 1;
+}
+
+static void *serve(void *arg)
+{
+	mock_server_t *server = arg;
+	uint8_t setup_request[12];
+	uint8_t *request = 0;
+	size_t request_size = 0;
+
+	if(!read_all(server->fd, setup_request, sizeof(setup_request)))
+		return 0;
+	{
+		size_t namelen = *(uint16_t *) (setup_request + 6);
+		size_t datalen = *(uint16_t *) (setup_request + 8);
+		uint8_t auth[2 * 65536 + 8];
+		size_t len = namelen + XCB_TYPE_PAD(uint32_t, namelen) + datalen + XCB_TYPE_PAD(uint32_t, datalen);
+		if(!read_all(server->fd, auth, len) ||
+		   !write_all(server->fd, &canned_setup, sizeof(canned_setup)))
+			return 0;
+	}
+
+	for(;;)
+	{
+		struct pollfd fds[2];
+		uint8_t header[8];
+		size_t length, offset = 4;
+
+		fds[0].fd = server->fd;
+		fds[0].events = POLLIN;
+		fds[1].fd = server->wake[0];
+		fds[1].events = POLLIN;
+		if(poll(fds, 2, -1) < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			break;
+		}
+		if((fds[1].revents & POLLIN) && !send_floods(server))
+			break;
+		if(!fds[0].revents)
+			continue;
+
+		if(!read_all(server->fd, header, 4))
+			break;
+		length = *(uint16_t *) (header + 2);
+		if(!length)
+		{
+			/* BIG-REQUESTS */
+			if(!read_all(server->fd, header + 4, 4))
+				break;
+			length = *(uint32_t *) (header + 4);
+			offset = 8;
+		}
+		length *= 4;
+		if(length < offset)
+			break;
+		if(length > request_size)
+		{
+			uint8_t *bigger = realloc(request, length);
+			if(!bigger)
+				break;
+			request = bigger;
+			request_size = length;
+		}
+		memcpy(request, header, offset);
+		if(!read_all(server->fd, request + offset, length - offset))
+			break;
+
+		++server->sequence;
+		pthread_mutex_lock(&server->lock);
+		++server->requests[request[0]];
+		pthread_mutex_unlock(&server->lock);
+		if(!handle_request(server, request, length))
+			break;
+	}
+	free(request);
+	return 0;
+}
+
+mock_server_t *mock_server_new(void)
+{
+	mock_server_t *server = calloc(1, sizeof(*server));
+	if(!server)
+		return 0;
+	server->fd = -1;
+	server->wake[0] = server->wake[1] = -1;
+	server->floods_tail = &server->floods;
+	pthread_mutex_init(&server->lock, 0);
+	if(!canned_setup.setup.status)
+		init_setup();
+	return server;
+}
+
+void mock_server_add_extension(mock_server_t *server, const char *name, uint8_t major_opcode, uint8_t first_event, uint8_t first_error)
+{
+	struct extension *ext;
+	if(server->extensions_len == MAX_EXTENSIONS)
+		return;
+	ext = &server->extensions[server->extensions_len++];
+	ext->name = strdup(name);
+	ext->major_opcode = major_opcode;
+	ext->first_event = first_event;
+	ext->first_error = first_error;
+}
+
+void mock_server_set_handler(mock_server_t *server, mock_request_handler_t handler, void *data)
+{
+	server->handler = handler;
+	server->handler_data = data;
+}
+
+void mock_server_set_latency(mock_server_t *server, unsigned int usec)
+{
+	server->latency = usec;
+}
+
+xcb_connection_t *mock_server_connect(mock_server_t *server)
+{
+	int sv[2];
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+		return 0;
+	if(!mock_server_start(server, sv[1]))
+	{
+		close(sv[0]);
+		return 0;
+	}
+	return xcb_connect_to_fd(sv[0], 0);
+}
+
+int mock_server_start(mock_server_t *server, int fd)
+{
+	if(pipe(server->wake))
+	{
+		close(fd);
+		return 0;
+	}
+	server->fd = fd;
+	if(pthread_create(&server->thread, 0, serve, server))
+	{
+		server->fd = -1;
+		close(fd);
+		close(server->wake[0]);
+		close(server->wake[1]);
+		server->wake[0] = server->wake[1] = -1;
+		return 0;
+	}
+	server->running = 1;
+	return 1;
+}
+
+void mock_server_flood(mock_server_t *server, uint8_t response_type, unsigned int count)
+{
+	struct flood *flood = malloc(sizeof(*flood));
+	if(!flood)
+		return;
+	flood->next = 0;
+	flood->response_type = response_type;
+	flood->count = count;
+	pthread_mutex_lock(&server->lock);
+	*server->floods_tail = flood;
+	server->floods_tail = &flood->next;
+	pthread_mutex_unlock(&server->lock);
+	if(write(server->wake[1], "", 1) != 1)
+		return;
+}
+
+int mock_server_send(mock_server_t *server, const void *packet, size_t length)
+{
+	return write_all(server->fd, packet, length);
+}
+
+unsigned int mock_server_requests(mock_server_t *server, uint8_t major_opcode)
+{
+	unsigned int ret;
+	pthread_mutex_lock(&server->lock);
+	ret = server->requests[major_opcode];
+	pthread_mutex_unlock(&server->lock);
+	return ret;
+}
+
+void mock_server_free(mock_server_t *server)
+{
+	struct flood *flood;
+	int i;
+	if(server->running)
+		pthread_join(server->thread, 0);
+	if(server->fd >= 0)
+		close(server->fd);
+	if(server->wake[0] >= 0)
+	{
+		close(server->wake[0]);
+		close(server->wake[1]);
+	}
+	for(flood = server->floods; flood; )
+	{
+		struct flood *next = flood->next;
+		free(flood);
+		flood = next;
+	}
+	for(i = 0; i < server->atoms_len; ++i)
+		free(server->atoms[i]);
+	free(server->atoms);
+	for(i = 0; i < server->extensions_len; ++i)
+		free(server->extensions[i].name);
+	pthread_mutex_destroy(&server->lock);
+	free(server);
+}
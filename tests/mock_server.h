@@ -0,0 +1,53 @@
+/* An X server in a thread, for tests and benchmarks that must run without
+ * a display. It talks to xcb_connect_to_fd over a socketpair, sends a
+ * canned setup with one 1024x768 TrueColor screen, and answers
+ * GetInputFocus, InternAtom and QueryExtension; every other request is
+ * read and ignored unless a request handler deals with it. */
+
+#ifndef MOCK_SERVER_H
+#define MOCK_SERVER_H
+
+#include "xcb.h"
+
+#define MOCK_SERVER_ROOT 0x100
+#define MOCK_SERVER_ROOT_VISUAL 0x21
+
+typedef struct mock_server_t mock_server_t;
+
+/* Runs in the server thread before the built-in handling of each request,
+ * which is skipped if it returns nonzero. The request is complete,
+ * including any BIG-REQUESTS length. */
+typedef int (*mock_request_handler_t)(mock_server_t *server, const uint8_t *request, size_t length, uint16_t sequence, void *data);
+
+mock_server_t *mock_server_new(void);
+
+/* Configuration; call these before mock_server_connect. */
+void mock_server_add_extension(mock_server_t *server, const char *name, uint8_t major_opcode, uint8_t first_event, uint8_t first_error);
+void mock_server_set_handler(mock_server_t *server, mock_request_handler_t handler, void *data);
+
+/* Delay before each reply, in microseconds; may change at any time. */
+void mock_server_set_latency(mock_server_t *server, unsigned int usec);
+
+/* Starts the server thread and connects to it. */
+xcb_connection_t *mock_server_connect(mock_server_t *server);
+
+/* Starts the server thread on a socket the client connects to by other
+ * means, such as one accepted from a listening socket. Returns 0 on
+ * failure, in which case the socket is closed. */
+int mock_server_start(mock_server_t *server, int fd);
+
+/* Has the server thread send count events of the given type, numbered
+ * from 0 in bytes 4 to 7, as soon as it is between requests. */
+void mock_server_flood(mock_server_t *server, uint8_t response_type, unsigned int count);
+
+/* For request handlers: sends a packet to the client. */
+int mock_server_send(mock_server_t *server, const void *packet, size_t length);
+
+/* How many requests with this major opcode have been read. */
+unsigned int mock_server_requests(mock_server_t *server, uint8_t major_opcode);
+
+/* Waits for the server thread to see the client hang up, then frees the
+ * server. Call after xcb_disconnect. */
+void mock_server_free(mock_server_t *server);
+
+#endif